@@ -0,0 +1,167 @@
+/**
+ * The heap: every allocation not in a context goes through the
+ * allocator hooks from here, and is counted. Each block starts with
+ * a header holding its size, so that frees can be counted too.
+ *
+ * The counters are per thread, so counting takes no lock. Without
+ * thread-local storage they fall back to one set behind a mutex.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <qr/allocator.h>
+
+#include "alloc.h"
+#include "thread.h"
+
+#define HEADER QR_ALIGN(sizeof(size_t))
+
+static void * std_alloc(void * user, size_t size)
+{
+        (void) user;
+        return malloc(size);
+}
+
+static void * std_realloc(void * user, void * ptr, size_t size)
+{
+        (void) user;
+        return realloc(ptr, size);
+}
+
+static void std_free(void * user, void * ptr)
+{
+        (void) user;
+        free(ptr);
+}
+
+static struct qr_allocator allocator = {
+        std_alloc, std_realloc, std_free, 0
+};
+
+#ifdef QR_THREAD_LOCAL
+static QR_THREAD_LOCAL struct qr_alloc_stats stats;
+#define lock_stats()    ((void) 0)
+#define unlock_stats()  ((void) 0)
+#else
+static struct qr_alloc_stats stats;
+static qr_mutex stats_lock = QR_MUTEX_INIT;
+#define lock_stats()    qr_mutex_lock(&stats_lock)
+#define unlock_stats()  qr_mutex_unlock(&stats_lock)
+#endif
+
+void qr_set_allocator(const struct qr_allocator * a)
+{
+        if (a) {
+                allocator = *a;
+        } else {
+                allocator.alloc = std_alloc;
+                allocator.realloc = std_realloc;
+                allocator.free = std_free;
+                allocator.user = 0;
+        }
+}
+
+void qr_get_alloc_stats(struct qr_alloc_stats * s)
+{
+        lock_stats();
+        *s = stats;
+        unlock_stats();
+}
+
+void qr_reset_alloc_stats(void)
+{
+        lock_stats();
+        stats.count = 0;
+        stats.bytes = 0;
+        stats.peak = stats.current;
+        unlock_stats();
+}
+
+/* Add the counts in src to dest, as if they came after it */
+static void add_stats(struct qr_alloc_stats *       dest,
+                      const struct qr_alloc_stats * src)
+{
+        dest->count += src->count;
+        dest->bytes += src->bytes;
+        if (dest->current + src->peak > dest->peak)
+                dest->peak = dest->current + src->peak;
+        dest->current += src->current;
+}
+
+void qr_alloc_stats_take(struct qr_alloc_stats * s)
+{
+        lock_stats();
+        add_stats(s, &stats);
+        memset(&stats, 0, sizeof(stats));
+        unlock_stats();
+}
+
+void qr_alloc_stats_give(const struct qr_alloc_stats * s)
+{
+        lock_stats();
+        add_stats(&stats, s);
+        unlock_stats();
+}
+
+/* A block of old_size bytes is now size bytes (either may be 0) */
+static void count(size_t old_size, size_t size)
+{
+        lock_stats();
+        if (size > 0) {
+                stats.count++;
+                stats.bytes += size;
+        }
+        stats.current += (long) size;
+        stats.current -= (long) old_size;
+        if (stats.current > stats.peak)
+                stats.peak = stats.current;
+        unlock_stats();
+}
+
+void * qr_heap_alloc(size_t size)
+{
+        unsigned char * p;
+
+        p = allocator.alloc(allocator.user, HEADER + size);
+        if (!p)
+                return 0;
+
+        *(size_t *) p = size;
+        count(0, size);
+
+        return p + HEADER;
+}
+
+void * qr_heap_realloc(void * ptr, size_t size)
+{
+        unsigned char * p;
+        size_t old_size;
+
+        if (!ptr)
+                return qr_heap_alloc(size);
+
+        p = (unsigned char *) ptr - HEADER;
+        old_size = *(size_t *) p;
+
+        p = allocator.realloc(allocator.user, p, HEADER + size);
+        if (!p)
+                return 0;
+
+        *(size_t *) p = size;
+        count(old_size, size);
+
+        return p + HEADER;
+}
+
+void qr_heap_free(void * ptr)
+{
+        unsigned char * p;
+
+        if (!ptr)
+                return;
+
+        p = (unsigned char *) ptr - HEADER;
+        count(*(size_t *) p, 0);
+        allocator.free(allocator.user, p);
+}
@@ -0,0 +1,59 @@
+#ifndef QR_ALLOC_H
+#define QR_ALLOC_H
+
+#include <stddef.h>
+
+#include <qr/code.h>
+#include <qr/context.h>
+
+/* The strictest alignment malloc() has to meet, more or less */
+union qr_align {
+        long    l;
+        double  d;
+        void *  p;
+        void    (*f)(void);
+};
+
+#define QR_ALIGN(n) (((n) + sizeof(union qr_align) - 1) \
+                     / sizeof(union qr_align) * sizeof(union qr_align))
+
+/* The heap, through the allocator hooks (see qr/allocator.h) */
+void * qr_heap_alloc(size_t size);
+void * qr_heap_realloc(void * ptr, size_t size);
+void qr_heap_free(void * ptr);
+
+/* For threads that work on another's behalf (see pool.c): take adds
+ * the calling thread's allocation counters to s and zeroes them, and
+ * give adds s to the calling thread's
+ */
+struct qr_alloc_stats;
+void qr_alloc_stats_take(struct qr_alloc_stats * s);
+void qr_alloc_stats_give(const struct qr_alloc_stats * s);
+
+/* Allocate from ctx, or from the heap if ctx is NULL. Context memory
+ * is only given back by qr_context_reset() / qr_context_destroy(), so
+ * qr_free() of it does nothing (except undo the latest allocation).
+ * qr_realloc() needs the old size, since contexts do not record it.
+ */
+void * qr_alloc(struct qr_context * ctx, size_t size);
+void * qr_realloc(struct qr_context * ctx, void * ptr,
+                  size_t old_size, size_t size);
+void qr_free(struct qr_context * ctx, void * ptr);
+
+/* Constructors for the internal objects, in a context (or not) */
+struct qr_bitstream * qr_bitstream_create_in(struct qr_context * ctx);
+struct qr_bitmap * qr_bitmap_create_in(struct qr_context * ctx,
+                                       size_t width,
+                                       size_t height,
+                                       int masked);
+
+/* As qr_code_create_ex(), but with the working buffers taken from
+ * scratch rather than the code's own context
+ */
+struct qr_code * qr_code_create_scratch(const struct qr_data *         data,
+                                        const struct qr_code_options * options,
+                                        struct qr_code_info *          info,
+                                        struct qr_context *            scratch);
+
+#endif
+
@@ -0,0 +1,184 @@
+/**
+ * Batch encoding. The items are dealt out to the threads in equal
+ * runs, which each thread works through from the front. A thread
+ * that runs out steals the back half of whichever run has the most
+ * left, so a run of large symbols is shared out rather than left to
+ * its owner. Each thread builds its data, and the code's working
+ * buffers, in a context of its own, reset between items.
+ */
+
+#include <stdlib.h>
+
+#include <qr/batch.h>
+#include <qr/code.h>
+#include <qr/context.h>
+#include <qr/data.h>
+#include "alloc.h"
+#include "pool.h"
+#include "thread.h"
+
+struct run {
+        qr_mutex lock;
+        size_t   next;
+        size_t   end;
+};
+
+struct batch {
+        struct qr_batch_item *   items;
+        struct qr_code_options   options;
+        struct run               runs[QR_MAX_THREADS];
+        size_t                   failed[QR_MAX_THREADS];
+        int                      threads;
+};
+
+/* Take the next item of run r, if any is left */
+static int take(struct run * r, size_t * item)
+{
+        int ok;
+
+        qr_mutex_lock(&r->lock);
+        ok = r->next < r->end;
+        if (ok)
+                *item = r->next++;
+        qr_mutex_unlock(&r->lock);
+
+        return ok;
+}
+
+/* Move the back half of the fullest other run into run self */
+static int steal(struct batch * b, int self)
+{
+        size_t left, most = 0;
+        size_t start = 0, end = 0;
+        int i, victim = -1;
+
+        /* Only a guess, as the runs keep moving */
+        for (i = 0; i < b->threads; ++i) {
+                if (i == self)
+                        continue;
+
+                qr_mutex_lock(&b->runs[i].lock);
+                left = b->runs[i].end - b->runs[i].next;
+                qr_mutex_unlock(&b->runs[i].lock);
+
+                if (left > most) {
+                        most = left;
+                        victim = i;
+                }
+        }
+
+        if (victim < 0)
+                return 0;
+
+        qr_mutex_lock(&b->runs[victim].lock);
+        if (b->runs[victim].next < b->runs[victim].end) {
+                struct run * r = &b->runs[victim];
+
+                end = r->end;
+                start = r->next + (r->end - r->next) / 2;
+                r->end = start;
+        }
+        qr_mutex_unlock(&b->runs[victim].lock);
+
+        /* If the victim emptied meanwhile, look again */
+        if (start == end)
+                return 1;
+
+        qr_mutex_lock(&b->runs[self].lock);
+        b->runs[self].next = start;
+        b->runs[self].end = end;
+        qr_mutex_unlock(&b->runs[self].lock);
+
+        return 1;
+}
+
+static void encode(struct qr_batch_item * item,
+                   const struct qr_code_options * options,
+                   struct qr_context * scratch)
+{
+        struct qr_data * data;
+
+        if (scratch)
+                qr_context_reset(scratch);
+
+        item->code = 0;
+        item->info.mask = -1;
+        item->info.score = -1;
+
+        data = qr_data_create_ctx(scratch, item->version, item->ec,
+                                  item->type, item->input, item->length);
+        if (!data)
+                return;
+
+        item->code = qr_code_create_scratch(data, options,
+                                            &item->info, scratch);
+
+        qr_data_destroy(data);
+}
+
+static void work(void * arg, int self)
+{
+        struct batch * b = arg;
+        struct qr_context * scratch = qr_context_create(0, 0);
+        size_t item;
+
+        /* Without a context everything still works, from the heap */
+        do {
+                while (take(&b->runs[self], &item)) {
+                        encode(&b->items[item], &b->options, scratch);
+                        if (!b->items[item].code)
+                                ++b->failed[self];
+                }
+        } while (steal(b, self));
+
+        qr_context_destroy(scratch);
+}
+
+size_t qr_encode_batch(struct qr_batch_item *         items,
+                       size_t                         count,
+                       const struct qr_code_options * options)
+{
+        struct batch b;
+        size_t failed = 0;
+        int i;
+
+        if (count == 0)
+                return 0;
+
+        b.items = items;
+        if (options) {
+                b.options = *options;
+        } else {
+                b.options.policy = QR_MASK_FULL;
+                b.options.mask = 0;
+                b.options.threads = 0;
+        }
+        b.options.ctx = 0;
+
+        b.threads = b.options.threads;
+        if (b.threads < 1)
+                b.threads = 1;
+        if (b.threads > QR_MAX_THREADS)
+                b.threads = QR_MAX_THREADS;
+        if ((size_t) b.threads > count)
+                b.threads = (int) count;
+
+        /* The threads are already busy: one symbol each */
+        b.options.threads = 0;
+
+        for (i = 0; i < b.threads; ++i) {
+                qr_mutex_init(&b.runs[i].lock);
+                b.runs[i].next = count * i / b.threads;
+                b.runs[i].end = count * (i + 1) / b.threads;
+                b.failed[i] = 0;
+        }
+
+        qr_parallel_for(b.threads, b.threads, work, &b);
+
+        for (i = 0; i < b.threads; ++i) {
+                qr_mutex_destroy(&b.runs[i].lock);
+                failed += b.failed[i];
+        }
+
+        return failed;
+}
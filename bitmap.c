@@ -5,15 +5,26 @@
 
 #include <qr/bitmap.h>
 
+#include "alloc.h"
+
 struct qr_bitmap * qr_bitmap_create(size_t width, size_t height, int masked)
+{
+        return qr_bitmap_create_in(0, width, height, masked);
+}
+
+struct qr_bitmap * qr_bitmap_create_in(struct qr_context * ctx,
+                                       size_t width,
+                                       size_t height,
+                                       int masked)
 {
         struct qr_bitmap * out;
         size_t size;
 
-        out = malloc(sizeof(*out));
+        out = qr_alloc(ctx, sizeof(*out));
         if (!out)
-                goto fail;
+                return 0;
 
+        out->ctx = ctx;
         out->width = width;
         out->height = height;
         out->stride = (width / CHAR_BIT) + (width % CHAR_BIT ? 1 : 0);
@@ -21,13 +32,13 @@ struct qr_bitmap * qr_bitmap_create(size_t width, size_t height, int masked)
         size = out->stride * height;
 
         out->mask = 0;
-        out->bits = malloc(size);
+        out->bits = qr_alloc(ctx, size);
         if (!out->bits)
                 goto fail;
         memset(out->bits, 0, size);
 
         if (masked) {
-                out->mask = malloc(out->stride * width);
+                out->mask = qr_alloc(ctx, size);
                 if (!out->mask)
                         goto fail;
                 memset(out->mask, 0xFF, size);
@@ -43,16 +54,16 @@ fail:
 void qr_bitmap_destroy(struct qr_bitmap * bmp)
 {
         if (bmp) {
-                free(bmp->bits);
-                free(bmp->mask);
-                free(bmp);
+                qr_free(bmp->ctx, bmp->mask);
+                qr_free(bmp->ctx, bmp->bits);
+                qr_free(bmp->ctx, bmp);
         }
 }
 
 int qr_bitmap_add_mask(struct qr_bitmap * bmp)
 {
         size_t size = bmp->stride * bmp->width;
-        bmp->mask = malloc(size);
+        bmp->mask = qr_alloc(bmp->ctx, size);
         if (!bmp->mask)
                 return -1;
         memset(bmp->mask, 0xFF, size);
@@ -64,7 +75,8 @@ struct qr_bitmap * qr_bitmap_clone(const struct qr_bitmap * src)
         struct qr_bitmap * bmp;
         size_t size;
 
-        bmp = qr_bitmap_create(src->width, src->height, !!src->mask);
+        bmp = qr_bitmap_create_in(src->ctx, src->width, src->height,
+                                  !!src->mask);
         if (!bmp)
                 return 0;
 
@@ -0,0 +1,14 @@
+#include "bitops.h"
+
+/* Portable fallback; GCC and friends use the builtin instead */
+int (qr_popcount)(unsigned long x)
+{
+        int n = 0;
+
+        while (x) {
+                x &= x - 1;
+                ++n;
+        }
+
+        return n;
+}
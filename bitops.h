@@ -0,0 +1,11 @@
+#ifndef QR_BITOPS_H
+#define QR_BITOPS_H
+
+/* Number of set bits in x */
+int qr_popcount(unsigned long x);
+
+#ifdef __GNUC__
+#define qr_popcount(x) __builtin_popcountl(x)
+#endif
+
+#endif
@@ -1,8 +1,13 @@
 /**
- * It would perhaps be more sensible just to store the bits
- * as an array of char or similar, but this way is more fun.
- * This is a pretty inefficient implementation, althought I
- * suspect that won't be a problem.
+ * Bits are packed into the buffer least significant bit first, so
+ * stream bit n is bit (n % 8) of byte (n / 8).
+ *
+ * Reads and writes work on a whole field at once: the bytes it
+ * covers are bit-reversed and loaded most significant first into an
+ * unsigned long, which puts the stream in the natural (MSB-first)
+ * order of the values, and the field is then a shift and a mask
+ * away. A field can therefore be up to CHUNK_BITS long (57 bits with
+ * a 64-bit long); anything longer is split.
  */
 
 #include <stdlib.h>
@@ -12,10 +17,22 @@
 
 #include <qr/bitstream.h>
 
+#include "alloc.h"
+#include "constants.h"
+#include "segment.h"
+
+#if CHAR_BIT != 8
+#error "qr_bitstream assumes 8-bit bytes"
+#endif
+
+#define LONG_BITS  (sizeof(unsigned long) * CHAR_BIT)
+#define CHUNK_BITS ((int) LONG_BITS - (CHAR_BIT - 1))
+
 #define MAX(a, b) ((a) < (b) ? (b) : (a))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
 
 struct qr_bitstream {
+        struct qr_context * ctx;
         size_t pos;    /* bits */
         size_t count;  /* bits */
         size_t bufsiz; /* bytes */
@@ -43,12 +60,18 @@ static int ensure_available(struct qr_bitstream * stream, size_t bits)
 }
 
 struct qr_bitstream * qr_bitstream_create(void)
+{
+        return qr_bitstream_create_in(0);
+}
+
+struct qr_bitstream * qr_bitstream_create_in(struct qr_context * ctx)
 {
         struct qr_bitstream * obj;
 
-        obj = malloc(sizeof(*obj));
+        obj = qr_alloc(ctx, sizeof(*obj));
 
         if (obj) {
+                obj->ctx    = ctx;
                 obj->pos    = 0;
                 obj->count  = 0;
                 obj->bufsiz = 0;
@@ -64,7 +87,8 @@ int qr_bitstream_resize(struct qr_bitstream * stream, size_t bits)
         void * newbuf;
 
         newsize = bits_to_bytes(bits);
-        newbuf = realloc(stream->buffer, newsize);
+        newbuf = qr_realloc(stream->ctx, stream->buffer,
+                            stream->bufsiz, newsize);
 
         if (newbuf) {
                 stream->bufsiz = newsize;
@@ -76,26 +100,26 @@ int qr_bitstream_resize(struct qr_bitstream * stream, size_t bits)
 
 void qr_bitstream_destroy(struct qr_bitstream * stream)
 {
-        free(stream->buffer);
-        free(stream);
+        qr_free(stream->ctx, stream->buffer);
+        qr_free(stream->ctx, stream);
 }
 
 struct qr_bitstream * qr_bitstream_dup(const struct qr_bitstream * src)
 {
         struct qr_bitstream * ret;
 
-        ret = qr_bitstream_create();
+        ret = qr_bitstream_create_in(src->ctx);
         if (!ret)
                 return 0;
 
         if (qr_bitstream_resize(ret, src->count) != 0) {
-                free(ret);
+                qr_bitstream_destroy(ret);
                 return 0;
         }
 
         ret->pos   = src->pos;
         ret->count = src->count;
-        memcpy(ret->buffer, src->buffer, src->bufsiz);
+        memcpy(ret->buffer, src->buffer, ret->bufsiz);
 
         return ret;
 }
@@ -121,26 +145,118 @@ size_t qr_bitstream_size(const struct qr_bitstream * stream)
         return stream->count;
 }
 
+static unsigned long low_mask(int bits)
+{
+        return bits < (int) LONG_BITS ? (1UL << bits) - 1 : ~0UL;
+}
+
+/* Load the field of n bits at bit pos of buf, 0 < n <= CHUNK_BITS */
+static unsigned long read_chunk(const unsigned char * buf, size_t pos, int n)
+{
+        const unsigned char * byte = buf + pos / CHAR_BIT;
+        int offset = pos % CHAR_BIT;
+        int nbytes = (offset + n + CHAR_BIT - 1) / CHAR_BIT;
+        unsigned long acc = 0;
+        int i;
+
+        for (i = 0; i < nbytes; ++i)
+                acc = (acc << CHAR_BIT) | QR_BIT_REVERSE[byte[i]];
+
+        return (acc >> (nbytes * CHAR_BIT - offset - n)) & low_mask(n);
+}
+
+/* Store the field of n bits at bit pos of buf. Bits before it in the
+ * first byte are kept; any after it in the last byte are assumed to
+ * be past the end of the stream, and are cleared.
+ */
+static void write_chunk(unsigned char * buf,
+                        size_t pos,
+                        unsigned long value,
+                        int n)
+{
+        unsigned char * byte = buf + pos / CHAR_BIT;
+        int offset = pos % CHAR_BIT;
+        int nbytes = (offset + n + CHAR_BIT - 1) / CHAR_BIT;
+        int shift = nbytes * CHAR_BIT - offset - n;
+        unsigned long acc;
+        int i;
+
+        acc = (unsigned long) (QR_BIT_REVERSE[byte[0]] & ~(0xFFu >> offset))
+                << ((nbytes - 1) * CHAR_BIT);
+        acc |= (value & low_mask(n)) << shift;
+
+        for (i = nbytes - 1; i >= 0; --i) {
+                byte[i] = QR_BIT_REVERSE[acc & 0xFF];
+                acc >>= CHAR_BIT;
+        }
+}
+
+/* Append count bits, starting at bit pos of src, to dest (which must
+ * have room for them). Once dest is on a byte boundary the bulk of
+ * the bits go over a byte at a time: straight copied if src is then
+ * byte aligned too, otherwise each byte is merged from the two
+ * source bytes it straddles.
+ */
+static void copy_bits(struct qr_bitstream * dest,
+                      const unsigned char * src,
+                      size_t pos,
+                      size_t count)
+{
+        unsigned char * out;
+        const unsigned char * in;
+        size_t head, bytes, i;
+        int shift;
+
+        if (count == 0)
+                return;
+
+        head = MIN(count, (CHAR_BIT - dest->pos % CHAR_BIT) % CHAR_BIT);
+        if (head > 0) {
+                write_chunk(dest->buffer, dest->pos,
+                            read_chunk(src, pos, head), head);
+                dest->pos += head;
+                pos += head;
+                count -= head;
+        }
+
+        bytes = count / CHAR_BIT;
+        out = dest->buffer + dest->pos / CHAR_BIT;
+        in = src + pos / CHAR_BIT;
+        shift = pos % CHAR_BIT;
+
+        if (shift == 0) {
+                memmove(out, in, bytes);
+        } else {
+                for (i = 0; i < bytes; ++i)
+                        out[i] = (in[i] >> shift)
+                               | (in[i + 1] << (CHAR_BIT - shift));
+        }
+
+        dest->pos += bytes * CHAR_BIT;
+        pos += bytes * CHAR_BIT;
+        count -= bytes * CHAR_BIT;
+
+        if (count > 0) {
+                write_chunk(dest->buffer, dest->pos,
+                            read_chunk(src, pos, count), count);
+                dest->pos += count;
+        }
+}
+
 unsigned long qr_bitstream_read(struct qr_bitstream * stream, int bits)
 {
         unsigned long result = 0;
-        unsigned char * byte;
-        size_t bitnum;
+        int n;
 
+        assert(bits >= 0 && bits <= (int) LONG_BITS);
         assert(qr_bitstream_remaining(stream) >= (size_t) bits);
 
-        byte = stream->buffer + (stream->pos / CHAR_BIT);
-        bitnum = stream->pos % CHAR_BIT;
-
-        stream->pos += bits;
-
-        while (bits-- > 0) {
-                int bit = (*byte >> bitnum++) & 0x1;
-                result = (result << 1) | bit;
-                if (bitnum == CHAR_BIT) {
-                        bitnum = 0;
-                        ++byte;
-                }                
+        while (bits > 0) {
+                n = MIN(bits, CHUNK_BITS);
+                result = (n < (int) LONG_BITS ? result << n : 0)
+                        | read_chunk(stream->buffer, stream->pos, n);
+                stream->pos += n;
+                bits -= n;
         }
 
         return result;
@@ -161,41 +277,104 @@ int qr_bitstream_write(struct qr_bitstream * stream,
                     unsigned long      value,
                     int                bits)
 {
-        unsigned char * byte;
-        size_t bitnum;
+        int n;
+
+        assert(bits >= 0 && bits <= (int) LONG_BITS);
 
         if (ensure_available(stream, bits) != 0)
                 return -1;
 
-        byte = stream->buffer + (stream->pos / CHAR_BIT);
-        bitnum = stream->pos % CHAR_BIT;
+        while (bits > 0) {
+                n = MIN(bits, CHUNK_BITS);
+                bits -= n;
+                write_chunk(stream->buffer, stream->pos, value >> bits, n);
+                stream->pos += n;
+        }
 
-        stream->pos += bits;
         stream->count = stream->pos; /* truncate */
 
-        while (bits-- > 0) {
-                int bit = (value >> bits) & 0x1;
-                unsigned char mask = 1 << bitnum++;
-                *byte = (*byte & ~mask) | (bit ? mask : 0);
-                if (bitnum == CHAR_BIT) {
-                        bitnum = 0;
-                        ++byte;
-                }
-        }
-
         return 0;
 }
 
+/* As many fields as fit in a chunk go in with each write */
 int qr_bitstream_pack(struct qr_bitstream *   stream,
                    const unsigned int * values,
                    size_t               count,
                    int                  bitsize)
 {
+        const int per = bitsize > 0 ? CHUNK_BITS / bitsize : 0;
+
+        if (count == 0)
+                return 0;
         if (ensure_available(stream, count * bitsize) != 0)
                 return -1;
 
-        while (count--)
-                qr_bitstream_write(stream, *(values++), bitsize);
+        if (per < 2) {
+                while (count--)
+                        qr_bitstream_write(stream, *(values++), bitsize);
+                return 0;
+        }
+
+        while (count > 0) {
+                int n = (int) MIN(count, (size_t) per);
+                unsigned long acc = 0;
+                int i;
+
+                for (i = 0; i < n; ++i)
+                        acc = (acc << bitsize)
+                            | (*(values++) & low_mask(bitsize));
+
+                write_chunk(stream->buffer, stream->pos, acc, n * bitsize);
+                stream->pos += n * bitsize;
+                count -= n;
+        }
+
+        stream->count = stream->pos; /* truncate */
+
+        return 0;
+}
+
+/* Write count whole bytes. In the buffer each byte is just reversed,
+ * so on a byte boundary they go straight in; otherwise they are
+ * reversed a block at a time and copied in.
+ */
+int qr_bitstream_write_bytes(struct qr_bitstream * stream,
+                             const unsigned char * bytes,
+                             size_t                count)
+{
+        qr_reverse_kernel kernel = qr_reverse_simd_kernel();
+        unsigned char block[256];
+        unsigned char * out;
+        size_t n, i;
+
+        if (count == 0)
+                return 0;
+        if (ensure_available(stream, count * CHAR_BIT) != 0)
+                return -1;
+
+        while (count > 0) {
+                if (stream->pos % CHAR_BIT == 0) {
+                        n = count;
+                        out = stream->buffer + stream->pos / CHAR_BIT;
+                } else {
+                        n = MIN(count, sizeof(block));
+                        out = block;
+                }
+
+                i = kernel ? kernel(bytes, n, out) : 0;
+                for (; i < n; ++i)
+                        out[i] = QR_BIT_REVERSE[bytes[i]];
+
+                if (out == block)
+                        copy_bits(stream, block, 0, n * CHAR_BIT);
+                else
+                        stream->pos += n * CHAR_BIT;
+
+                bytes += n;
+                count -= n;
+        }
+
+        stream->count = stream->pos; /* truncate */
 
         return 0;
 }
@@ -203,15 +382,16 @@ int qr_bitstream_pack(struct qr_bitstream *   stream,
 int qr_bitstream_cat(struct qr_bitstream * dest, const struct qr_bitstream * src)
 {
         size_t count = qr_bitstream_size(src);
-        size_t srcpos;
+
+        /* Nothing copied leaves dest as it was, not truncated */
+        if (count == 0)
+                return 0;
 
         if (ensure_available(dest, count) != 0)
                 return -1;
 
-        srcpos = qr_bitstream_tell(src);
-        qr_bitstream_seek((struct qr_bitstream *)src, 0);
-        qr_bitstream_copy(dest, (struct qr_bitstream *)src, count);
-        qr_bitstream_seek((struct qr_bitstream *)src, srcpos);
+        copy_bits(dest, src->buffer, 0, count);
+        dest->count = dest->pos; /* truncate */
 
         return 0;
 }
@@ -222,22 +402,14 @@ int qr_bitstream_copy(struct qr_bitstream * dest,
 {
         if (qr_bitstream_remaining(src) < count)
                 return -1;
+        if (count == 0)
+                return 0;
         if (ensure_available(dest, count) != 0)
                 return -1;
 
-        /* uint must be at least 16 bits */
-        for (; count >= 16; count -= 16)
-                qr_bitstream_write(
-                        dest,
-                        qr_bitstream_read((struct qr_bitstream *)src, 16),
-                        16);
-
-        if (count > 0)
-                qr_bitstream_write(
-                        dest,
-                        qr_bitstream_read((struct qr_bitstream *)src, count),
-                        count);
+        copy_bits(dest, src->buffer, src->pos, count);
+        src->pos += count;
+        dest->count = dest->pos; /* truncate */
 
         return 0;
 }
-
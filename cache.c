@@ -0,0 +1,414 @@
+/**
+ * Symbol cache. Entries are spread over the shards by the hash of
+ * their key; each shard has its own lock, a chained hash table, and
+ * an LRU list. Symbols are encoded outside the lock, so a miss only
+ * holds the shard to insert the result.
+ *
+ * The budget is shared: an insert charges it first, then evicts from
+ * its own shard and, if that is not enough, from the others in turn,
+ * never holding two shard locks at once.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include <qr/bitmap.h>
+#include <qr/cache.h>
+#include <qr/code.h>
+#include <qr/data.h>
+#include "alloc.h"
+#include "plan.h"
+#include "thread.h"
+
+#define SHARDS  16
+#define BUCKETS 256
+
+struct entry {
+        struct entry * chain;  /* next in the bucket */
+        struct entry * prev;   /* LRU list, most recent first */
+        struct entry * next;
+
+        unsigned long     hash;
+        int               version;
+        enum qr_ec_level  ec;
+        enum qr_data_type type;
+        int               policy;  /* mask policy, or 8 + fixed mask */
+        size_t            length;
+
+        int               symbol;  /* version of the symbol */
+        int               width;
+        struct qr_code_info info;
+        size_t            size;    /* charged to the budget */
+
+        /* Followed by the input, and then the module bits */
+};
+
+#define ENTRY_HEADER QR_ALIGN(sizeof(struct entry))
+#define ENTRY_INPUT(e) ((char *) (e) + ENTRY_HEADER)
+#define ENTRY_BITS(e) ((unsigned char *) ENTRY_INPUT(e) + (e)->length)
+
+struct shard {
+        qr_mutex       lock;
+        struct entry * buckets[BUCKETS];
+        struct entry * head;
+        struct entry * tail;
+        size_t         bytes;
+        size_t         entries;
+        unsigned long  hits;
+        unsigned long  misses;
+        unsigned long  evictions;
+};
+
+struct qr_cache {
+        struct shard shards[SHARDS];
+
+        qr_mutex     lock;    /* for bytes */
+        size_t       budget;
+        size_t       bytes;   /* charged, over all the shards */
+};
+
+/* FNV-1a */
+static unsigned long hash_bytes(unsigned long h,
+                                const void *  data,
+                                size_t        length)
+{
+        const unsigned char * p = data;
+
+        while (length--)
+                h = (h ^ *p++) * 16777619UL;
+
+        return h;
+}
+
+static unsigned long hash_key(const struct entry * key, const char * input)
+{
+        unsigned long h = 2166136261UL;
+        int fields[4];
+
+        fields[0] = key->version;
+        fields[1] = key->ec;
+        fields[2] = key->type;
+        fields[3] = key->policy;
+
+        h = hash_bytes(h, fields, sizeof(fields));
+        return hash_bytes(h, input, key->length);
+}
+
+static int matches(const struct entry * e,
+                   const struct entry * key,
+                   const char *         input)
+{
+        return e->hash == key->hash
+            && e->version == key->version
+            && e->ec == key->ec
+            && e->type == key->type
+            && e->policy == key->policy
+            && e->length == key->length
+            && memcmp(ENTRY_INPUT(e), input, key->length) == 0;
+}
+
+static struct entry ** find(struct shard *       s,
+                            const struct entry * key,
+                            const char *         input)
+{
+        struct entry ** p = &s->buckets[key->hash / SHARDS % BUCKETS];
+
+        while (*p && !matches(*p, key, input))
+                p = &(*p)->chain;
+
+        return p;
+}
+
+static void unlink_lru(struct shard * s, struct entry * e)
+{
+        if (e->prev)
+                e->prev->next = e->next;
+        else
+                s->head = e->next;
+
+        if (e->next)
+                e->next->prev = e->prev;
+        else
+                s->tail = e->prev;
+}
+
+static void push_lru(struct shard * s, struct entry * e)
+{
+        e->prev = 0;
+        e->next = s->head;
+        if (s->head)
+                s->head->prev = e;
+        else
+                s->tail = e;
+        s->head = e;
+}
+
+/* Charge add bytes and give back sub; returns how far over budget
+ * the cache then is
+ */
+static size_t charge(struct qr_cache * cache, size_t add, size_t sub)
+{
+        size_t over;
+
+        qr_mutex_lock(&cache->lock);
+        cache->bytes = cache->bytes + add - sub;
+        over = cache->bytes > cache->budget
+                ? cache->bytes - cache->budget : 0;
+        qr_mutex_unlock(&cache->lock);
+
+        return over;
+}
+
+static size_t evict(struct qr_cache * cache, struct shard * s, struct entry * e)
+{
+        const size_t size = e->size;
+        struct entry ** p = &s->buckets[e->hash / SHARDS % BUCKETS];
+
+        while (*p != e)
+                p = &(*p)->chain;
+        *p = e->chain;
+
+        unlink_lru(s, e);
+        s->bytes -= e->size;
+        s->entries--;
+        s->evictions++;
+        qr_free(0, e);
+
+        return charge(cache, 0, size);
+}
+
+/* Evict least recently used entries of s (other than keep) until
+ * the cache is within budget; returns nonzero if it still is not
+ */
+static int trim(struct qr_cache *    cache,
+                struct shard *       s,
+                const struct entry * keep)
+{
+        size_t over = charge(cache, 0, 0);
+
+        while (over > 0 && s->tail && s->tail != keep)
+                over = evict(cache, s, s->tail);
+
+        return over > 0;
+}
+
+/* The largest entry there can be: a version 40 symbol holding as many
+ * digits as will fit
+ */
+static size_t largest_entry(void)
+{
+        const struct qr_symbol_plan * plan = QR_PLAN(40, QR_EC_LEVEL_L);
+        const size_t stride = (plan->width + CHAR_BIT - 1) / CHAR_BIT;
+
+        return ENTRY_HEADER + (size_t) plan->data_words * CHAR_BIT * 3 / 10
+             + stride * plan->width;
+}
+
+struct qr_cache * qr_cache_create(size_t budget)
+{
+        struct qr_cache * cache;
+        int i;
+
+        cache = qr_alloc(0, sizeof(*cache));
+        if (!cache)
+                return 0;
+
+        memset(cache, 0, sizeof(*cache));
+        for (i = 0; i < SHARDS; ++i)
+                qr_mutex_init(&cache->shards[i].lock);
+
+        qr_mutex_init(&cache->lock);
+        cache->budget = budget < largest_entry() ? largest_entry() : budget;
+
+        return cache;
+}
+
+void qr_cache_destroy(struct qr_cache * cache)
+{
+        struct entry * e, * next;
+        int i;
+
+        if (!cache)
+                return;
+
+        for (i = 0; i < SHARDS; ++i) {
+                for (e = cache->shards[i].head; e; e = next) {
+                        next = e->next;
+                        qr_free(0, e);
+                }
+                qr_mutex_destroy(&cache->shards[i].lock);
+        }
+
+        qr_mutex_destroy(&cache->lock);
+        qr_free(0, cache);
+}
+
+/* A new code holding the cached symbol */
+static struct qr_code * copy_out(const struct entry * e,
+                                 struct qr_context *  ctx)
+{
+        struct qr_code * code;
+
+        code = qr_alloc(ctx, sizeof(*code));
+        if (!code)
+                return 0;
+
+        code->version = e->symbol;
+        code->ctx = ctx;
+        code->modules = qr_bitmap_create_in(ctx, e->width, e->width, 0);
+        if (!code->modules) {
+                qr_free(ctx, code);
+                return 0;
+        }
+
+        memcpy(code->modules->bits, ENTRY_BITS(e),
+               code->modules->stride * code->modules->height);
+
+        return code;
+}
+
+static void insert(struct qr_cache *           cache,
+                   struct shard *              s,
+                   const struct entry *        key,
+                   const char *                input,
+                   const struct qr_code *      code,
+                   const struct qr_code_info * info)
+{
+        const struct qr_bitmap * bmp = code->modules;
+        const size_t nbits = bmp->stride * bmp->height;
+        const size_t size = ENTRY_HEADER + key->length + nbits;
+        struct entry ** p;
+        struct entry * e;
+        int i, over;
+
+        if (size > cache->budget)
+                return;
+
+        e = qr_alloc(0, size);
+        if (!e)
+                return;
+
+        *e = *key;
+        e->symbol = code->version;
+        e->width = bmp->width;
+        e->info = *info;
+        e->size = size;
+        memcpy(ENTRY_INPUT(e), input, key->length);
+        memcpy(ENTRY_BITS(e), bmp->bits, nbits);
+
+        qr_mutex_lock(&s->lock);
+
+        /* Another thread may have got there first */
+        if (*find(s, key, input)) {
+                qr_mutex_unlock(&s->lock);
+                qr_free(0, e);
+                return;
+        }
+
+        p = &s->buckets[e->hash / SHARDS % BUCKETS];
+        e->chain = *p;
+        *p = e;
+        push_lru(s, e);
+        s->bytes += size;
+        s->entries++;
+
+        charge(cache, size, 0);
+        over = trim(cache, s, e);
+
+        qr_mutex_unlock(&s->lock);
+
+        /* Room the other shards are holding on to */
+        for (i = 1; over && i < SHARDS; ++i) {
+                struct shard * t = &cache->shards[(s - cache->shards + i)
+                                                  % SHARDS];
+
+                qr_mutex_lock(&t->lock);
+                over = trim(cache, t, 0);
+                qr_mutex_unlock(&t->lock);
+        }
+}
+
+struct qr_code * qr_cache_encode(struct qr_cache *              cache,
+                                 int                            version,
+                                 enum qr_ec_level               ec,
+                                 enum qr_data_type              type,
+                                 const char *                   input,
+                                 size_t                         length,
+                                 const struct qr_code_options * options,
+                                 struct qr_code_info *          info)
+{
+        struct qr_context * ctx = options ? options->ctx : 0;
+        struct qr_code_info code_info;
+        struct qr_code * code;
+        struct qr_data * data;
+        struct shard * s;
+        struct entry ** p;
+        struct entry key;
+
+        memset(&key, 0, sizeof(key));
+        key.version = version;
+        key.ec = ec;
+        key.type = type;
+        key.policy = options ? options->policy : QR_MASK_FULL;
+        if (key.policy == QR_MASK_FIXED)
+                key.policy = 8 + options->mask;
+        key.length = length;
+        key.hash = hash_key(&key, input);
+
+        s = &cache->shards[key.hash % SHARDS];
+
+        qr_mutex_lock(&s->lock);
+        p = find(s, &key, input);
+        if (*p) {
+                struct entry * e = *p;
+
+                unlink_lru(s, e);
+                push_lru(s, e);
+                s->hits++;
+
+                code = copy_out(e, ctx);
+                code_info = e->info;
+                qr_mutex_unlock(&s->lock);
+
+                if (!code)
+                        return 0;
+        } else {
+                s->misses++;
+                qr_mutex_unlock(&s->lock);
+
+                data = qr_data_create(version, ec, type, input, length);
+                if (!data)
+                        return 0;
+
+                code = qr_code_create_ex(data, options, &code_info);
+                qr_data_destroy(data);
+                if (!code)
+                        return 0;
+
+                insert(cache, s, &key, input, code, &code_info);
+        }
+
+        if (info)
+                *info = code_info;
+
+        return code;
+}
+
+void qr_cache_stats(struct qr_cache * cache, struct qr_cache_stats * stats)
+{
+        int i;
+
+        memset(stats, 0, sizeof(*stats));
+
+        for (i = 0; i < SHARDS; ++i) {
+                struct shard * s = &cache->shards[i];
+
+                qr_mutex_lock(&s->lock);
+                stats->hits += s->hits;
+                stats->misses += s->misses;
+                stats->evictions += s->evictions;
+                stats->entries += s->entries;
+                stats->bytes += s->bytes;
+                qr_mutex_unlock(&s->lock);
+        }
+}
@@ -6,41 +6,26 @@
 #include <qr/bitstream.h>
 #include <qr/code.h>
 #include <qr/common.h>
+#include "alloc.h"
 #include "constants.h"
+#include "plan.h"
 
 void qr_code_destroy(struct qr_code * code)
 {
         if (code) {
                 qr_bitmap_destroy(code->modules);
-                free(code);
+                qr_free(code->ctx, code);
         }
 }
 
 int qr_code_width(const struct qr_code * code)
 {
-        return code->version * 4 + 17;
+        return QR_GEOMETRY(code->version)->width;
 }
 
 size_t qr_code_total_capacity(int version)
 {
-	int side = version * 4 + 17;
-
-	int alignment_side = version > 1 ? (version / 7) + 2 : 0;
-
-	int alignment_count = alignment_side >= 2 ?
-		alignment_side * alignment_side - 3 : 0;
-
-	int locator_bits = 8*8*3;
-
-	int format_bits = 8*4 - 1 + (version >= 7 ? 6*3*2 : 0);
-
-	int timing_bits = 2 * (side - 8*2 -
-		(alignment_side > 2 ? (alignment_side - 2) * 5 : 0));
-
-	int function_bits = timing_bits + format_bits + locator_bits
-		+ alignment_count * 5*5;
-
-	return side * side - function_bits;
+        return QR_GEOMETRY(version)->capacity;
 }
 
 void qr_get_rs_block_sizes(int version,
@@ -49,60 +34,43 @@ void qr_get_rs_block_sizes(int version,
                            int data_length[2],
                            int ec_length[2])
 {
-        /* FIXME: rather than using a big static table, better to
-         * calculate these values.
-         */
-        int total_words = qr_code_total_capacity(version) / 8;
-        int data_words = QR_DATA_WORD_COUNT[version - 1][ec ^ 0x1];
-        int ec_words = total_words - data_words;
-        int total_blocks;
-
-        block_count[0] = QR_RS_BLOCK_COUNT[version - 1][ec ^ 0x1][0];
-        block_count[1] = QR_RS_BLOCK_COUNT[version - 1][ec ^ 0x1][1];
-        total_blocks = block_count[0] + block_count[1];
+        const struct qr_symbol_plan * plan = QR_PLAN(version, ec);
 
-        data_length[0] = data_words / total_blocks;
-        data_length[1] = data_length[0] + 1;
-
-        assert(data_length[0] * block_count[0] +
-               data_length[1] * block_count[1] == data_words);
-
-        ec_length[0] = ec_length[1] = ec_words / total_blocks;
-
-        assert(ec_length[0] * block_count[0] +
-               ec_length[1] * block_count[1] == ec_words);
-        assert(data_words + ec_words == total_words);
+        block_count[0] = plan->block_count[0];
+        block_count[1] = plan->block_count[1];
+        data_length[0] = plan->data_length[0];
+        data_length[1] = plan->data_length[1];
+        ec_length[0] = ec_length[1] = plan->ec_length;
 }
 
 void qr_mask_apply(struct qr_bitmap * bmp, int mask)
 {
+        /* Only modules in the bitmap's mask (if it has one) are
+         * changed, and never the padding at the end of each row.
+         */
+        const size_t n = bmp->stride - 1;
+        const unsigned char last = bmp->width % CHAR_BIT ?
+                (1 << (bmp->width % CHAR_BIT)) - 1 : 0xFF;
         size_t i, j;
 
         assert((mask & 0x7) == mask);
+        assert(bmp->stride <= sizeof(QR_MASK_ROWS[0][0]));
         mask &= 0x7;
 
-        /* Slow version for now; we can optimize later */
-
         for (i = 0; i < bmp->height; ++i) {
                 unsigned char * p = bmp->bits + i * bmp->stride;
-
-                for (j = 0; j < bmp->width; ++j) {
-                        int bit = j % CHAR_BIT;
-                        size_t off = j / CHAR_BIT;
-                        int t;
-
-                        switch (mask) {
-                        case 0: t = (i + j) % 2; break;
-                        case 1: t = i % 2; break;
-                        case 2: t = j % 3; break;
-                        case 3: t = (i + j) % 3; break;
-                        case 4: t = (i/2 + j/3) % 2; break;
-                        case 5: t = ((i*j) % 2) + ((i*j) % 3); break;
-                        case 6: t = (((i*j) % 2) + ((i*j) % 3)) % 2; break;
-                        case 7: t = (((i*j) % 3) + ((i+j) % 2)) % 2; break;
-                        }
-
-                        p[off] ^= (t == 0) << bit;
+                const unsigned char * t = QR_MASK_ROWS[mask][i % 12];
+
+                if (bmp->mask) {
+                        const unsigned char * m = bmp->mask + i * bmp->stride;
+
+                        for (j = 0; j < n; ++j)
+                                p[j] ^= t[j] & m[j];
+                        p[n] ^= t[n] & m[n] & last;
+                } else {
+                        for (j = 0; j < n; ++j)
+                                p[j] ^= t[j];
+                        p[n] ^= t[n] & last;
                 }
         }
 }
@@ -7,151 +7,152 @@
 #include <qr/code.h>
 #include <qr/common.h>
 #include <qr/layout.h>
+#include "alloc.h"
 #include "constants.h"
+#include "plan.h"
+#include "template.h"
+#include "thread.h"
 
-struct qr_iterator {
-        struct qr_code * code;
-        int dim;
-        int column;
-        int row;
-        int up;
-        int mask;
-        unsigned char * p;
-};
-
-void qr_layout_init_mask(struct qr_code * code)
+int qr_layout_init_mask(struct qr_code * code)
 {
-        size_t x, y;
-        size_t dim = qr_code_width(code);
+        const struct qr_template * tpl = qr_template_get(code->version);
         struct qr_bitmap * bmp = code->modules;
-        const int * am_pos = QR_ALIGNMENT_LOCATION[code->version - 1];
-        size_t am_side;
-
-        if (!bmp->mask)
-                qr_bitmap_add_mask(bmp);
 
-        assert(bmp->mask);
+        if (!tpl)
+                return -1;
 
-        memset(bmp->mask, 0, bmp->height * bmp->stride);
+        if (!bmp->mask && qr_bitmap_add_mask(bmp) != 0)
+                return -1;
 
-        /* slow and stupid, but I'm sleepy */
-        for (y = 0; y < bmp->height; ++y) {
-                unsigned char * row = bmp->mask + y * bmp->stride;
-                for (x = 0; x < bmp->width; ++x) {
-                        unsigned char bit = 1 << (x % CHAR_BIT);
-                        int off = x / CHAR_BIT;
+        assert(bmp->stride == tpl->stride && bmp->height == tpl->width);
 
-                        if (x == 6 || y == 6) /* timing */
-                                continue;
-
-                        if (x < 9 && y < 9) /* top-left */
-                                continue;
-
-                        if (x >= dim - 8 && y < 9) /* top-right */
-                                continue;
-
-                        if (x < 9 && y >= dim - 8) /* bottom-left */
-                                continue;
-
-                        /* version info */
-                        if (code->version >= 7) {
-                                if (y < 6 && x >= dim - 11)
-                                        continue;
-                                if (x < 6 && y >= dim - 11)
-                                        continue;
-                        }
-
-                        row[off] |= bit;
-                }
-        }
+        memcpy(bmp->mask, tpl->mask, bmp->height * bmp->stride);
 
-        /* Alignment pattern */
-        am_side = code->version > 1 ? (code->version / 7) + 2 : 0;
-        for (y = 0; y < am_side; ++y) {
-                for (x = 0; x < am_side; ++x) {
-                        int i, j;
-
-                        if ((x == 0 && y == 0) ||
-                            (x == 0 && y == am_side - 1) ||
-                            (x == am_side - 1 && y == 0))
-                                continue;
-
-                        for (j = -2; j <= 2; ++j) {
-                                unsigned char * row = bmp->mask + (am_pos[y]+j) * bmp->stride;
-                                for (i = -2; i <= 2; ++i) {
-                                        unsigned char bit = 1 << ((am_pos[x]+i) % CHAR_BIT);
-                                        int off = (am_pos[x]+i) / CHAR_BIT;
-
-                                        row[off] &= ~bit;
-                                }
-                        }
-                }
-        }
+        return 0;
 }
 
-static int is_data_bit(const struct qr_iterator * i)
-{
-        unsigned char bit = 1 << (i->column % CHAR_BIT);
-        int off = (i->row * i->code->modules->stride) + (i->column / CHAR_BIT);
-
-        return i->code->modules->mask[off] & bit;
-}
+/* Codeword bits are placed by walking a zig-zag path over the
+ * symbol, skipping function modules. The path only depends on the
+ * version, so it is walked once per version into a table of module
+ * positions (byte offset * 8 + bit), in the order the bits are placed.
+ */
+struct walk {
+        const struct qr_template * tpl;
+        int dim;
+        int column;
+        int row;
+        int up;
+};
 
-static void set_pointer(struct qr_iterator * i)
+static int is_data_bit(const struct walk * w)
 {
-        i->mask = 1 << (i->column % CHAR_BIT);
-        i->p = i->code->modules->bits
-                + i->code->modules->stride * i->row
-                + i->column / CHAR_BIT;
+        unsigned char bit = 1 << (w->column % CHAR_BIT);
+        int off = (w->row * w->tpl->stride) + (w->column / CHAR_BIT);
+
+        return w->tpl->mask[off] & bit;
 }
 
-static void advance(struct qr_iterator * i)
+static void advance(struct walk * w)
 {
         do {
                 /* This XOR is to account for the vertical strip of
                  * timing bits in column 6 which displaces everything.
                  */
-                if ((i->column < 6) ^ !(i->column % 2)) {
+                if ((w->column < 6) ^ !(w->column % 2)) {
                         /* Right-hand part or at left edge */
-                        i->column -= 1;
+                        w->column -= 1;
                 } else {
                         /* Left-hand part */
-                        i->column += 1;
+                        w->column += 1;
 
-                        if (( i->up && i->row == 0) ||
-                            (!i->up && i->row == i->dim - 1)) {
+                        if (( w->up && w->row == 0) ||
+                            (!w->up && w->row == w->dim - 1)) {
                                 /* Hit the top / bottom */
-                                i->column -= 2;
-                                i->up = !i->up;
+                                w->column -= 2;
+                                w->up = !w->up;
                         } else {
-                                i->row += i->up ? -1 : 1;
+                                w->row += w->up ? -1 : 1;
                         }
                 }
 
-                if (i->column < 0)
+                if (w->column < 0)
                         continue; /* don't go off left edge */
 
                 /* Check for one-past-end */
-                if (i->column == 0 && i->row >= i->dim - 8)
+                if (w->column == 0 && w->row >= w->dim - 8)
                         break;
 
-        } while (!is_data_bit(i));
+        } while (!is_data_bit(w));
+}
+
+static unsigned short * build_placement(int version)
+{
+        const struct qr_symbol_plan * geom = QR_GEOMETRY(version);
+        const size_t count = geom->total_words * QR_WORD_BITS;
+        unsigned short * table;
+        struct walk w;
+        size_t n;
+
+        w.tpl = qr_template_get(version);
+        if (!w.tpl)
+                return 0;
+
+        table = malloc(count * sizeof(*table));
+        if (!table)
+                return 0;
+
+        w.dim = geom->width;
+        w.column = w.dim - 1;
+        w.row = w.dim - 1;
+        w.up = 1;
+
+        for (n = 0; n < count; ++n) {
+                table[n] = (w.row * w.tpl->stride
+                            + w.column / CHAR_BIT) * CHAR_BIT
+                         + w.column % CHAR_BIT;
+                advance(&w);
+        }
 
-        set_pointer(i);
+        return table;
 }
 
+/* Built on first use, and never freed */
+static const unsigned short * placement[40];
+static qr_mutex placement_lock = QR_MUTEX_INIT;
+
+static const unsigned short * get_placement(int version)
+{
+        const unsigned short * table;
+
+        qr_mutex_lock(&placement_lock);
+        if (!placement[version - 1])
+                placement[version - 1] = build_placement(version);
+        table = placement[version - 1];
+        qr_mutex_unlock(&placement_lock);
+
+        return table;
+}
+
+struct qr_iterator {
+        struct qr_code * code;
+        const unsigned short * table;
+        size_t pos;
+};
+
 struct qr_iterator * qr_layout_begin(struct qr_code * code)
 {
+        const unsigned short * table;
         struct qr_iterator * i;
 
-        i = malloc(sizeof(*i));
+        table = get_placement(code->version);
+        if (!table)
+                return 0;
+
+        i = qr_alloc(code->ctx, sizeof(*i));
         if (i) {
-                i->dim = qr_code_width(code);
                 i->code = code;
-                i->column = i->dim - 1;
-                i->row = i->dim - 1;
-                i->up = 1;
-                set_pointer(i);
+                i->table = table;
+                i->pos = 0;
         }
 
         return i;
@@ -159,30 +160,93 @@ struct qr_iterator * qr_layout_begin(struct qr_code * code)
 
 void qr_layout_end(struct qr_iterator * i)
 {
-        free(i);
+        qr_free(i->code->ctx, i);
 }
 
 unsigned int qr_layout_read(struct qr_iterator * i)
 {
+        const unsigned char * bits = i->code->modules->bits;
+        const unsigned short * t = i->table + i->pos;
         unsigned int x = 0;
         int b;
 
-        for (b = 0; b < QR_WORD_BITS; ++b) {
-                x = (x << 1) | ((*i->p & i->mask) ? 1 : 0);
-                advance(i);
-        }
+        for (b = 0; b < QR_WORD_BITS; ++b)
+                x = (x << 1) | ((bits[t[b] / CHAR_BIT] >> (t[b] % CHAR_BIT)) & 1);
+
+        i->pos += QR_WORD_BITS;
 
         return x;
 }
 
 void qr_layout_write(struct qr_iterator * i, unsigned int x)
 {
+        unsigned char * bits = i->code->modules->bits;
+        const unsigned short * t = i->table + i->pos;
         int b;
 
-        for (b = 0; b < QR_WORD_BITS; ++b) {
-                *i->p |= (x & 0x80) ? i->mask : 0;
-                advance(i);
-                x <<= 1;
+        for (b = 0; b < QR_WORD_BITS; ++b)
+                bits[t[b] / CHAR_BIT] |= ((x >> (7 - b)) & 1) << (t[b] % CHAR_BIT);
+
+        i->pos += QR_WORD_BITS;
+}
+
+int qr_layout_write_words(struct qr_code *     code,
+                          const unsigned char * words,
+                          size_t                count)
+{
+        const unsigned short * t = get_placement(code->version);
+        unsigned char * bits = code->modules->bits;
+        size_t w;
+        int b;
+
+        if (!t)
+                return -1;
+
+        for (w = 0; w < count; ++w, t += QR_WORD_BITS)
+                for (b = 0; b < QR_WORD_BITS; ++b)
+                        bits[t[b] / CHAR_BIT] |=
+                                ((words[w] >> (7 - b)) & 1) << (t[b] % CHAR_BIT);
+
+        return 0;
+}
+
+int qr_layout_read_words(const struct qr_code * code,
+                         unsigned char *        words,
+                         size_t                 count)
+{
+        const unsigned short * t = get_placement(code->version);
+        const unsigned char * bits = code->modules->bits;
+        size_t w;
+        int b;
+
+        if (!t)
+                return -1;
+
+        for (w = 0; w < count; ++w, t += QR_WORD_BITS) {
+                unsigned int x = 0;
+                for (b = 0; b < QR_WORD_BITS; ++b)
+                        x = (x << 1) | ((bits[t[b] / CHAR_BIT] >> (t[b] % CHAR_BIT)) & 1);
+                words[w] = x;
         }
+
+        return 0;
 }
 
+int qr_layout_flip_word(struct qr_code * code,
+                        size_t           index,
+                        unsigned int     bits)
+{
+        const unsigned short * t = get_placement(code->version);
+        unsigned char * out = code->modules->bits;
+        int b;
+
+        if (!t)
+                return -1;
+
+        t += index * QR_WORD_BITS;
+        for (b = 0; b < QR_WORD_BITS; ++b)
+                if ((bits >> (7 - b)) & 1)
+                        out[t[b] / CHAR_BIT] ^= 1 << (t[b] % CHAR_BIT);
+
+        return 0;
+}
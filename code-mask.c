@@ -0,0 +1,418 @@
+/**
+ * Mask selection. The finished symbol for each of the eight masks is
+ * scored in a single pass down the rows, with the eight candidate
+ * rows built side by side as bit-planes. Each row is packed into a
+ * few unsigned longs, and each penalty rule becomes a handful of
+ * shifts and bitwise operations plus a popcount: along the row for
+ * the row rules, and against the rows above it for the column rules.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <qr/bitmap.h>
+#include <qr/code.h>
+#include "bitops.h"
+#include "constants.h"
+#include "mask.h"
+#include "pool.h"
+#include "template.h"
+
+/* Penalty weights */
+#define N1 3
+#define N2 3
+#define N3 40
+#define N4 10
+
+#define LONG_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+/* Enough words for a row of the largest symbol */
+#define ROW_WORDS ((177 + LONG_BITS - 1) / LONG_BITS)
+
+/* A packed row of modules: module x is bit x % LONG_BITS of word
+ * x / LONG_BITS, and bits past the end of the row are always zero.
+ */
+typedef unsigned long qr_row[ROW_WORDS];
+
+static void pack_row(qr_row r, const unsigned char * bytes, size_t n)
+{
+        size_t i;
+
+        memset(r, 0, sizeof(qr_row));
+        for (i = 0; i < n; ++i)
+                r[i / sizeof(unsigned long)] |= (unsigned long) bytes[i]
+                        << (i % sizeof(unsigned long) * CHAR_BIT);
+}
+
+/* dst = src >> k (towards module 0), 0 < k < LONG_BITS */
+static void shift_down(qr_row dst, const qr_row src, int k)
+{
+        size_t i;
+
+        for (i = 0; i < ROW_WORDS - 1; ++i)
+                dst[i] = (src[i] >> k) | (src[i + 1] << (LONG_BITS - k));
+        dst[i] = src[i] >> k;
+}
+
+/* dst = src << k (away from module 0), 0 < k < LONG_BITS */
+static void shift_up(qr_row dst, const qr_row src, int k)
+{
+        size_t i;
+
+        for (i = ROW_WORDS - 1; i > 0; --i)
+                dst[i] = (src[i] << k) | (src[i - 1] >> (LONG_BITS - k));
+        dst[0] = src[0] << k;
+}
+
+/* The first n bits */
+static void first_bits(qr_row dst, long n)
+{
+        size_t i;
+
+        for (i = 0; i < ROW_WORDS; ++i) {
+                long b = n - (long) (i * LONG_BITS);
+
+                if (b <= 0)
+                        dst[i] = 0;
+                else if (b >= (long) LONG_BITS)
+                        dst[i] = ~0UL;
+                else
+                        dst[i] = (1UL << b) - 1;
+        }
+}
+
+/* Rules 1 and 3 along one row of n modules */
+static long line_penalty(const qr_row r, int n)
+{
+        qr_row s[11], before, v4, v6;
+        long runs = 0, starts = 0, finders = 0;
+        size_t i;
+        int k;
+
+        memcpy(s[0], r, sizeof(qr_row));
+        for (k = 1; k <= 10; ++k)
+                shift_down(s[k], r, k);
+
+        first_bits(v4, n - 4);
+        first_bits(v6, n - 6);
+
+        /* Light modules before a position; anything off the edge of
+         * the symbol counts as light.
+         */
+        shift_up(before, r, 1);
+        for (k = 2; k <= 4; ++k) {
+                qr_row t;
+                shift_up(t, r, k);
+                for (i = 0; i < ROW_WORDS; ++i)
+                        before[i] |= t[i];
+        }
+
+        for (i = 0; i < ROW_WORDS; ++i) {
+                unsigned long same, finder, after;
+
+                /* x ... x + 4 all the same colour */
+                same = ~(s[0][i] ^ s[1][i]) & ~(s[1][i] ^ s[2][i])
+                     & ~(s[2][i] ^ s[3][i]) & ~(s[3][i] ^ s[4][i])
+                     & v4[i];
+                runs += qr_popcount(same);
+
+                /* 1:1:3:1:1 starting at x */
+                finder = s[0][i] & ~s[1][i] & s[2][i] & s[3][i]
+                       & s[4][i] & ~s[5][i] & s[6][i] & v6[i];
+                after = s[7][i] | s[8][i] | s[9][i] | s[10][i];
+                finders += qr_popcount(finder & (~after | ~before[i]));
+
+                s[0][i] = same;
+        }
+
+        /* A run of length L >= 5 has L - 4 windows of five, and
+         * scores N1 + (L - 5); count where each run starts.
+         */
+        shift_up(s[1], s[0], 1);
+        for (i = 0; i < ROW_WORDS; ++i)
+                starts += qr_popcount(s[0][i] & ~s[1][i]);
+
+        return runs + (N1 - 1) * starts + N3 * finders;
+}
+
+/* Rule 2 for the pair of rows a (above) and b */
+static long block_penalty(const qr_row a, const qr_row b, int n)
+{
+        qr_row eq, eq1, a1, v1;
+        long blocks = 0;
+        size_t i;
+
+        for (i = 0; i < ROW_WORDS; ++i)
+                eq[i] = ~(a[i] ^ b[i]);
+        shift_down(eq1, eq, 1);
+        shift_down(a1, a, 1);
+        first_bits(v1, n - 1);
+
+        for (i = 0; i < ROW_WORDS; ++i)
+                blocks += qr_popcount(eq[i] & eq1[i] & ~(a[i] ^ a1[i]) & v1[i]);
+
+        return N2 * blocks;
+}
+
+/* Rows of history kept for the column rules: a 1:1:3:1:1 pattern
+ * and the four modules either side of it span 15 rows.
+ */
+#define HISTORY 16
+
+struct mask_state {
+        qr_row history[HISTORY];
+        qr_row same;    /* columns uniform over the last 5 rows */
+        long   score;
+        long   dark;
+};
+
+static const unsigned long * history_row(const struct mask_state * st,
+                                         int y)
+{
+        static const qr_row light;
+
+        return y < 0 ? light : st->history[y % HISTORY];
+}
+
+/* Build row y of the finished symbol for masks first ... last - 1 */
+static void build_rows(const struct qr_template * tpl,
+                       const unsigned char *      data,
+                       enum qr_ec_level           ec,
+                       size_t                     y,
+                       int                        first,
+                       int                        last,
+                       struct mask_state          st[8])
+{
+        const size_t stride = tpl->stride;
+        const size_t o = y * stride;
+        unsigned char bytes[ROW_WORDS * sizeof(unsigned long)];
+        size_t i;
+        int mask, f;
+
+        for (mask = first; mask < last; ++mask) {
+                const unsigned char * t = QR_MASK_ROWS[mask][y % 12];
+                const unsigned char * fv =
+                        tpl->format_value[(ec & 0x3) << 3 | mask];
+
+                for (i = 0; i < stride; ++i)
+                        bytes[i] = tpl->bits[o + i]
+                                 | ((data[o + i] ^ t[i]) & tpl->mask[o + i]);
+
+                for (f = 0; f < tpl->format_count; ++f)
+                        if (tpl->format_offset[f] / stride == y)
+                                bytes[tpl->format_offset[f] - o] |= fv[f];
+
+                pack_row(st[mask].history[y % HISTORY], bytes, stride);
+        }
+}
+
+/* Rules 1 and 3 down the columns, for the rows seen up to row y */
+static long column_penalty(struct mask_state * st, int y, int n)
+{
+        const unsigned long * r[15];
+        qr_row valid;
+        long runs = 0, starts = 0, finders = 0;
+        size_t i;
+        int k, s;
+
+        first_bits(valid, n);
+
+        /* Runs: as for rows, count uniform windows of 5 ending at y,
+         * and those that start a new run
+         */
+        if (y >= 4 && y < n) {
+                for (k = 0; k < 5; ++k)
+                        r[k] = history_row(st, y - k);
+
+                for (i = 0; i < ROW_WORDS; ++i) {
+                        unsigned long same = valid[i];
+
+                        for (k = 0; k < 4; ++k)
+                                same &= ~(r[k][i] ^ r[k + 1][i]);
+
+                        runs += qr_popcount(same);
+                        starts += qr_popcount(same & ~st->same[i]);
+                        st->same[i] = same;
+                }
+        }
+
+        /* Finder patterns in rows s ... s + 6 */
+        s = y - 10;
+        if (s >= 0 && s <= n - 7) {
+                for (k = 0; k < 15; ++k)
+                        r[k] = history_row(st, s - 4 + k);
+
+                for (i = 0; i < ROW_WORDS; ++i) {
+                        unsigned long finder, before, after;
+
+                        finder = r[4][i] & ~r[5][i] & r[6][i] & r[7][i]
+                               & r[8][i] & ~r[9][i] & r[10][i];
+                        before = r[0][i] | r[1][i] | r[2][i] | r[3][i];
+                        after = r[11][i] | r[12][i] | r[13][i] | r[14][i];
+
+                        finders += qr_popcount(finder & (~before | ~after));
+                }
+        }
+
+        return runs + (N1 - 1) * starts + N3 * finders;
+}
+
+/* QR_MASK_FAST looks at two rows out of every FAST_STEP */
+#define FAST_STEP 8
+
+/* Score masks first ... last - 1 into score[first] ... */
+static void score_masks(const struct qr_template * tpl,
+                        const unsigned char *      data,
+                        enum qr_ec_level           ec,
+                        enum qr_mask_policy        policy,
+                        int                        first,
+                        int                        last,
+                        long                       score[8])
+{
+        struct mask_state st[8];
+        const int n = tpl->width;
+        const int columns = (policy == QR_MASK_FULL);
+        int y, mask, rows = 0;
+        long modules;
+        size_t i;
+
+        for (mask = first; mask < last; ++mask)
+                memset(&st[mask], 0, sizeof(st[mask]));
+
+        /* A sample of row pairs, for rules 1 ~ 3 along and between
+         * them and rule 4 over their modules. The penalties are scaled
+         * up to the whole symbol, counting the rows twice in place of
+         * the columns.
+         */
+        for (y = 0; !columns && y < n; ++y) {
+                if (y % FAST_STEP > 1)
+                        continue;
+
+                build_rows(tpl, data, ec, y, first, last, st);
+                ++rows;
+
+                for (mask = first; mask < last; ++mask) {
+                        struct mask_state * m = &st[mask];
+                        unsigned long * cur = m->history[y % HISTORY];
+
+                        for (i = 0; i < ROW_WORDS; ++i)
+                                m->dark += qr_popcount(cur[i]);
+
+                        m->score += 2L * n * line_penalty(cur, n);
+                        if (y % FAST_STEP == 1)
+                                m->score += 2L * n * block_penalty(
+                                        history_row(m, y - 1), cur, n);
+                }
+        }
+
+        /* Otherwise one pass down the symbol, with the masks side by
+         * side. The last few rows are past the bottom edge (light),
+         * to finish off the column rules.
+         */
+        for (y = 0; columns && y < n + 4; ++y) {
+                if (y < n)
+                        build_rows(tpl, data, ec, y, first, last, st);
+
+                for (mask = first; mask < last; ++mask) {
+                        struct mask_state * m = &st[mask];
+                        unsigned long * cur = m->history[y % HISTORY];
+
+                        if (y >= n) {
+                                memset(cur, 0, sizeof(qr_row));
+                        } else {
+                                for (i = 0; i < ROW_WORDS; ++i)
+                                        m->dark += qr_popcount(cur[i]);
+
+                                m->score += line_penalty(cur, n);
+                                if (y > 0)
+                                        m->score += block_penalty(
+                                                history_row(m, y - 1), cur, n);
+                        }
+
+                        m->score += column_penalty(m, y, n);
+                }
+        }
+
+        if (columns) {
+                rows = n;
+        } else {
+                for (mask = first; mask < last; ++mask)
+                        st[mask].score /= rows;
+        }
+
+        /* Rule 4: N4 for each 5% away from half dark */
+        modules = (long) n * rows;
+        for (mask = first; mask < last; ++mask)
+                score[mask] = st[mask].score + N4
+                        * (labs(20 * st[mask].dark - 10 * modules) / modules);
+}
+
+void qr_mask_scores(const struct qr_template * tpl,
+                    const unsigned char *      data,
+                    enum qr_ec_level           ec,
+                    enum qr_mask_policy        policy,
+                    long                       score[8])
+{
+        score_masks(tpl, data, ec, policy, 0, 8, score);
+}
+
+/* With threads, each mask is scored on its own by a task */
+struct score_task {
+        const struct qr_template * tpl;
+        const unsigned char *      data;
+        enum qr_ec_level           ec;
+        enum qr_mask_policy        policy;
+        long *                     score;
+};
+
+static void score_one(void * arg, int mask)
+{
+        const struct score_task * t = arg;
+
+        score_masks(t->tpl, t->data, t->ec, t->policy,
+                    mask, mask + 1, t->score);
+}
+
+int qr_mask_select(const struct qr_code * code,
+                   enum qr_ec_level       ec,
+                   enum qr_mask_policy    policy,
+                   int                    threads,
+                   long *                 score)
+{
+        const struct qr_template * tpl = qr_template_get(code->version);
+        long scores[8];
+        int mask, selected;
+
+        if (!tpl)
+                return -1;
+
+        assert(code->modules->stride == tpl->stride);
+        assert(tpl->stride <= sizeof(QR_MASK_ROWS[0][0]));
+
+        if (threads > 1) {
+                struct score_task task;
+
+                task.tpl = tpl;
+                task.data = code->modules->bits;
+                task.ec = ec;
+                task.policy = policy;
+                task.score = scores;
+
+                qr_parallel_for(threads, 8, score_one, &task);
+        } else {
+                qr_mask_scores(tpl, code->modules->bits, ec, policy, scores);
+        }
+
+        /* Ties go to the lowest mask, however the scores came in */
+        selected = 0;
+        for (mask = 1; mask < 8; ++mask)
+                if (scores[mask] < scores[selected])
+                        selected = mask;
+
+        if (score)
+                *score = scores[selected];
+
+        return selected;
+}
@@ -1,4 +1,3 @@
-#include <assert.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,8 +10,11 @@
 #include <qr/layout.h>
 #include <qr/parse.h>
 
+#include "alloc.h"
+#include "bitops.h"
 #include "constants.h"
 #include "galois.h"
+#include "plan.h"
 
 /* XXX: duplicated */
 static int get_px(const struct qr_bitmap * bmp, int x, int y)
@@ -23,82 +25,155 @@ static int get_px(const struct qr_bitmap * bmp, int x, int y)
         return bmp->bits[off] & bit;
 }
 
-static int unpack_bits(int version,
-                       enum qr_ec_level ec,
-                       struct qr_bitstream * raw_bits,
-                       struct qr_bitstream * bits_out)
+/* Both the format and version info are BCH codes which can correct
+ * up to 3 bit errors (their codewords are at least 7 bits apart).
+ * Since there are so few codewords we just compare against every one
+ * of them, taking the nearest match to either copy in the symbol.
+ */
+#define BCH_MAX_ERRORS 3
+
+static int bch_distance(unsigned long a, unsigned long b1, unsigned long b2)
 {
-        /* FIXME: more comments to explain the algorithm */
+        int d1 = qr_popcount(a ^ b1);
+        int d2 = qr_popcount(a ^ b2);
 
-        int total_words = qr_code_total_capacity(version) / QR_WORD_BITS;
-        int block_count[2], data_length[2], ec_length[2];
-        int total_blocks;
-        int i, w, block;
-        struct qr_bitstream ** blocks = 0;
-        int status = -1;
+        return d1 < d2 ? d1 : d2;
+}
 
-        qr_get_rs_block_sizes(version, ec, block_count, data_length, ec_length);
-        total_blocks = block_count[0] + block_count[1];
+static int decode_format(unsigned long bits1, unsigned long bits2,
+                         enum qr_ec_level * ec, int * mask)
+{
+        int i, d, best, best_dist;
 
-        status = qr_bitstream_resize(bits_out,
-                (block_count[0] * data_length[0] +
-                 block_count[1] * data_length[1]) * QR_WORD_BITS);
-        if (status != 0)
-                goto cleanup;
+        best = 0;
+        best_dist = bch_distance(QR_FORMAT_BITS[0], bits1, bits2);
 
-        blocks = malloc(total_blocks * sizeof(*blocks));
-        if (blocks == NULL)
-                goto cleanup;
+        for (i = 1; i < 32; ++i) {
+                d = bch_distance(QR_FORMAT_BITS[i], bits1, bits2);
+                if (d < best_dist) {
+                        best = i;
+                        best_dist = d;
+                }
+        }
 
-        for (i = 0; i < total_blocks; ++i)
-                blocks[i] = NULL;
+        if (best_dist > BCH_MAX_ERRORS)
+                return -1;
 
-        /* Allocate temporary space for the blocks */
-        for (i = 0; i < total_blocks; ++i) {
-                int type = (i >= block_count[0]);
-                blocks[i] = qr_bitstream_create();
-                if (blocks[i] == NULL)
-                        goto cleanup;
-                status = qr_bitstream_resize(blocks[i],
-                        (data_length[type] + ec_length[type]) * QR_WORD_BITS);
-                if (status != 0)
-                        goto cleanup;
+        *mask = best & 7;
+        *ec = best >> 3;
+
+        return best_dist;
+}
+
+static int decode_version(unsigned long bits1, unsigned long bits2,
+                          int * version)
+{
+        int v, d, best, best_dist;
+
+        best = 7;
+        best_dist = bch_distance(QR_VERSION_BITS[7 - 1], bits1, bits2);
+
+        for (v = 8; v <= 40; ++v) {
+                d = bch_distance(QR_VERSION_BITS[v - 1], bits1, bits2);
+                if (d < best_dist) {
+                        best = v;
+                        best_dist = d;
+                }
         }
 
-        /* Read in the data & EC (see spec table 19) */
+        if (best_dist > BCH_MAX_ERRORS)
+                return -1;
+
+        *version = best;
+
+        return best_dist;
+}
+
+/* Offset of an RS block when they are all laid out end to end */
+static int block_start(const struct qr_symbol_plan * plan, int block)
+{
+        int start = block * (plan->data_length[0] + plan->ec_length);
+
+        if (block > plan->block_count[0])
+                start += block - plan->block_count[0];
+
+        return start;
+}
+
+static int unpack_bits(const struct qr_symbol_plan * plan,
+                       const unsigned char * raw,
+                       struct qr_bitstream * bits_out)
+{
+        /* The symbol holds the data words of every block interleaved
+         * word by word, then the EC words likewise (see spec table 19).
+         * Any long blocks come last and carry one extra data word,
+         * which is interleaved after all the others. We gather the
+         * blocks back together, run each through the RS decoder, and
+         * write out the corrected data words in order.
+         */
+
+        const int * block_count = plan->block_count;
+        const int * data_length = plan->data_length;
+        const int ec_length = plan->ec_length;
+        const int total_blocks = plan->total_blocks;
+        const int max_data = data_length[block_count[1] ? 1 : 0];
+        int w, block, type, start, errors;
+        unsigned char * words = 0;
+        int status = -1;
+
+        status = qr_bitstream_resize(bits_out,
+                                     plan->data_words * QR_WORD_BITS);
+        if (status != 0)
+                goto cleanup;
+
+        status = -1;
+        words = qr_alloc(0, plan->total_words);
+        if (words == NULL)
+                goto cleanup;
 
-        qr_bitstream_seek(raw_bits, 0);
+        /* Read in the data & EC */
 
         fprintf(stderr, "block counts %d and %d\n", block_count[0], block_count[1]);
         fprintf(stderr, "row lengths %d and %d\n", data_length[0], data_length[1]);
 
-        block = 0;
-        for (w = 0; w < total_words; ++w) {
-                if (block == 0 && w / total_blocks >= data_length[0] && block_count[1] != 0) {
-                        /* Skip the short blocks, if there are any */
-                        block += block_count[0];
+        for (w = 0; w < max_data; ++w) {
+                block = (w < data_length[0]) ? 0 : block_count[0];
+                for (; block < total_blocks; ++block) {
+                        start = block_start(plan, block);
+                        words[start + w] = *raw++;
+                }
+        }
+
+        for (w = 0; w < ec_length; ++w) {
+                for (block = 0; block < total_blocks; ++block) {
+                        type = (block >= block_count[0]);
+                        start = block_start(plan, block);
+                        words[start + data_length[type] + w] = *raw++;
                 }
-                qr_bitstream_copy(blocks[block], raw_bits, QR_WORD_BITS);
-                block = (block + 1) % total_blocks;
         }
 
-        /* XXX: apply ec */
+        /* Apply EC */
 
         for (block = 0; block < total_blocks; ++block) {
-                int type = (block >= block_count[0]);
-                struct qr_bitstream * stream = blocks[block];
-                qr_bitstream_seek(stream, 0);
-                qr_bitstream_copy(bits_out, stream, data_length[type] * QR_WORD_BITS);
+                unsigned char * p;
+
+                start = block_start(plan, block);
+                p = words + start;
+                type = (block >= block_count[0]);
+                errors = rs_correct_block(p,
+                                          data_length[type] + ec_length,
+                                          ec_length);
+                if (errors < 0)
+                        goto cleanup;
+
+                for (w = 0; w < data_length[type]; ++w)
+                        qr_bitstream_write(bits_out, p[w], QR_WORD_BITS);
         }
+
         status = 0;
 
 cleanup:
-        if (blocks != NULL) {
-                for (block = 0; block < total_blocks; ++block)
-                        if (blocks[block] != NULL)
-                                qr_bitstream_destroy(blocks[block]);
-                free(blocks);
-        }
+        qr_free(0, words);
 
         return status;
 }
@@ -107,33 +182,18 @@ static int read_bits(const struct qr_code * code,
                      enum qr_ec_level ec,
                      struct qr_bitstream * data_bits)
 {
-        const size_t total_bits = qr_code_total_capacity(code->version);
-        const size_t total_words = total_bits / QR_WORD_BITS;
-        struct qr_bitstream * raw_bits;
-        struct qr_iterator * layout;
-        size_t w;
+        const struct qr_symbol_plan * plan = QR_PLAN(code->version, ec);
+        unsigned char * raw;
         int ret = -1;
 
-        raw_bits = qr_bitstream_create();
-        if (raw_bits == NULL)
-                goto cleanup;
-
-        ret = qr_bitstream_resize(raw_bits, total_words * QR_WORD_BITS);
-        if (ret != 0)
-                goto cleanup;
-
-        layout = qr_layout_begin((struct qr_code *) code); /* dropping const! */
-        if (layout == NULL)
-                goto cleanup;
-        for (w = 0; w < total_words; ++w)
-                qr_bitstream_write(raw_bits, qr_layout_read(layout), QR_WORD_BITS);
-        qr_layout_end(layout);
+        raw = qr_alloc(0, plan->total_words);
+        if (raw == NULL)
+                return -1;
 
-        ret = unpack_bits(code->version, ec, raw_bits, data_bits);
+        if (qr_layout_read_words(code, raw, plan->total_words) == 0)
+                ret = unpack_bits(plan, raw, data_bits);
 
-cleanup:
-        if (raw_bits != NULL)
-                qr_bitstream_destroy(raw_bits);
+        qr_free(0, raw);
 
         return ret;
 }
@@ -143,9 +203,7 @@ static int read_format(const struct qr_bitmap * bmp, enum qr_ec_level * ec, int
         int dim;
         int i;
         unsigned bits1, bits2;
-        enum qr_ec_level ec1, ec2;
-        int mask1, mask2;
-        int err1, err2;
+        int err;
 
         dim = bmp->width;
         bits1 = bits2 = 0;
@@ -162,18 +220,9 @@ static int read_format(const struct qr_bitmap * bmp, enum qr_ec_level * ec, int
 
         fprintf(stderr, "read format bits %x / %x\n", bits1, bits2);
 
-        err1 = qr_decode_format(bits1, &ec1, &mask1);
-        err2 = qr_decode_format(bits2, &ec2, &mask2);
-
-        if (err1 < 0 && err2 < 0)
-                return -1;
+        err = decode_format(bits1, bits2, ec, mask);
 
-        if (err1 < err2)
-                *ec = ec1, *mask = mask1;
-        else
-                *ec = ec2, *mask = mask2;
-
-        return 0;
+        return err < 0 ? -1 : 0;
 }
 
 static int read_version(const struct qr_bitmap * bmp)
@@ -181,8 +230,7 @@ static int read_version(const struct qr_bitmap * bmp)
         int dim;
         int i;
         unsigned long bits1, bits2;
-        int ver1, ver2;
-        int err1, err2;
+        int version = -1, err;
 
         dim = bmp->width;
         bits1 = bits2 = 0;
@@ -194,15 +242,11 @@ static int read_version(const struct qr_bitmap * bmp)
 
         fprintf(stderr, "read version bits %lx / %lx\n", bits1, bits2);
 
-        err1 = qr_decode_version(bits1, &ver1);
-        err2 = qr_decode_version(bits2, &ver2);
-
-        fprintf(stderr, "got versions %d[%d] / %d[%d]\n", ver1, err1, ver2, err2);
+        err = decode_version(bits1, bits2, &version);
 
-        if (err1 < 0 && err2 < 0)
-                return -1;
+        fprintf(stderr, "got version %d[%d]\n", version, err);
 
-        return err1 < err2 ? ver1 : ver2;
+        return err < 0 ? -1 : version;
 }
 
 int qr_code_parse(const void *      buffer,
@@ -230,6 +274,7 @@ int qr_code_parse(const void *      buffer,
         }
 
         code.version = (line_bits - 17) / 4;
+        code.ctx = NULL;
         fprintf(stderr, "assuming version %d\n", code.version);
 
         src_bmp.bits = (unsigned char *) buffer; /* dropping const! */
@@ -237,6 +282,7 @@ int qr_code_parse(const void *      buffer,
         src_bmp.stride = line_stride;
         src_bmp.width = line_bits;
         src_bmp.height = line_count;
+        src_bmp.ctx = NULL;
 
         if (code.version >= 7 && read_version(&src_bmp) != code.version) {
                 fprintf(stderr, "Invalid version info\n");
@@ -257,7 +303,10 @@ int qr_code_parse(const void *      buffer,
         }
         qr_mask_apply(code.modules, mask);
 
-        qr_layout_init_mask(&code);
+        if (qr_layout_init_mask(&code) != 0) {
+                status = -1;
+                goto cleanup;
+        }
 
         data_bits = qr_bitstream_create();
         if (data_bits == NULL) {
@@ -269,7 +318,7 @@ int qr_code_parse(const void *      buffer,
         if (status != 0)
                 goto cleanup;
 
-        *data = malloc(sizeof(**data));
+        *data = qr_alloc(0, sizeof(**data));
         if (*data == NULL) {
                 status = -1;
                 goto cleanup;
@@ -279,6 +328,7 @@ int qr_code_parse(const void *      buffer,
         (*data)->ec = ec;
         (*data)->bits = data_bits;
         (*data)->offset = 0;
+        (*data)->ctx = NULL;
 
         data_bits = 0;
         status = 0;
@@ -294,55 +344,13 @@ cleanup:
 
 int qr_decode_format(unsigned long bits, enum qr_ec_level * ec, int * mask)
 {
-        bits ^= QR_FORMAT_MASK;
-
-        /* TODO: check and fix errors */
-
-        bits >>= 10;
-        *mask = bits & 7;
-        *ec = bits >> 3;
-
-        return 0;
+        return decode_format(bits, bits, ec, mask);
 }
 
 int qr_decode_version(unsigned long bits, int * version)
 {
-        int v, errors;
-        unsigned long version_bits;
-        int best_err, best_version;
-
         if (bits != (bits & 0x3FFFF))
                 fprintf(stderr, "WARNING: excess version bits");
 
-        best_err = 18;
-
-        for (v = 7; v <= 40; ++v) {
-                /* FIXME: cache these values */
-                /* see calc_version_bits() */
-                version_bits = v;
-                version_bits <<= 12;
-                version_bits |= gf_residue(version_bits, QR_VERSION_POLY);
-
-                /* count errors */
-                errors = 0;
-                version_bits ^= bits;
-                while (version_bits != 0) {
-                        if ((version_bits & 1) == 1)
-                                ++errors;
-                        version_bits >>= 1;
-                }
-
-                if (errors < best_err) {
-                        best_version = v;
-                        best_err = errors;
-                }
-
-                if (errors == 0) /* can we do better than this? */
-                        break;
-        }
-
-        *version = best_version;
-
-        return best_err;
+        return decode_version(bits, bits, version);
 }
-
@@ -0,0 +1,275 @@
+/**
+ * Per-version symbol templates. These are drawn module by module,
+ * but only once per version; symbols are then built from them a
+ * byte at a time.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <qr/types.h>
+#include "constants.h"
+#include "plan.h"
+#include "template.h"
+#include "thread.h"
+
+static void setpx(unsigned char * bits, size_t stride, int x, int y)
+{
+        bits[y * stride + x / CHAR_BIT] |= 1 << (x % CHAR_BIT);
+}
+
+static void clearpx(unsigned char * bits, size_t stride, int x, int y)
+{
+        bits[y * stride + x / CHAR_BIT] &= ~(1 << (x % CHAR_BIT));
+}
+
+static void draw_locator(struct qr_template * tpl, int x, int y)
+{
+        const size_t s = tpl->stride;
+        int i;
+
+        for (i = 0; i < 6; ++i) {
+                setpx(tpl->bits, s, x + i, y + 0);
+                setpx(tpl->bits, s, x + 6, y + i);
+                setpx(tpl->bits, s, x + i + 1, y + 6);
+                setpx(tpl->bits, s, x, y + i + 1);
+        }
+        for (i = 0; i < 9; ++i)
+                setpx(tpl->bits, s, x + 2 + i % 3, y + 2 + i / 3);
+}
+
+static void draw_patterns(struct qr_template * tpl)
+{
+        const struct qr_symbol_plan * geom = QR_GEOMETRY(tpl->version);
+        const int dim = geom->width;
+        const int am_side = geom->alignment_side;
+        const int * am_pos = geom->alignment;
+        const size_t s = tpl->stride;
+        long bits;
+        int i, x, y;
+
+        /* Locator pattern */
+        draw_locator(tpl, 0, 0);
+        draw_locator(tpl, 0, dim - 7);
+        draw_locator(tpl, dim - 7, 0);
+
+        /* Timing pattern */
+        for (i = 8; i < dim - 8; i += 2) {
+                setpx(tpl->bits, s, i, 6);
+                setpx(tpl->bits, s, 6, i);
+        }
+
+        /* Alignment pattern */
+        for (y = 0; y < am_side; ++y) {
+                for (x = 0; x < am_side; ++x) {
+                        if ((x == 0 && y == 0) ||
+                            (x == 0 && y == am_side - 1) ||
+                            (x == am_side - 1 && y == 0))
+                                continue;
+
+                        for (i = -2; i < 2; ++i) {
+                                setpx(tpl->bits, s, am_pos[x] + i, am_pos[y] - 2);
+                                setpx(tpl->bits, s, am_pos[x] + 2, am_pos[y] + i);
+                                setpx(tpl->bits, s, am_pos[x] - i, am_pos[y] + 2);
+                                setpx(tpl->bits, s, am_pos[x] - 2, am_pos[y] - i);
+                        }
+                        setpx(tpl->bits, s, am_pos[x], am_pos[y]);
+                }
+        }
+
+        /* Dark module */
+        setpx(tpl->bits, s, 8, dim - 8);
+
+        /* Version info */
+        if (tpl->version >= 7) {
+                bits = QR_VERSION_BITS[tpl->version - 1];
+
+                for (i = 0; i < 18; ++i) {
+                        if (bits & 0x1) {
+                                int a = i % 3, b = i / 3;
+                                setpx(tpl->bits, s, dim - 11 + a, b);
+                                setpx(tpl->bits, s, b, dim - 11 + a);
+                        }
+                        bits >>= 1;
+                }
+        }
+}
+
+static void draw_mask(struct qr_template * tpl)
+{
+        const struct qr_symbol_plan * geom = QR_GEOMETRY(tpl->version);
+        const int dim = geom->width;
+        const int am_side = geom->alignment_side;
+        const int * am_pos = geom->alignment;
+        const size_t s = tpl->stride;
+        int x, y, i, j;
+
+        for (y = 0; y < dim; ++y) {
+                for (x = 0; x < dim; ++x) {
+                        if (x == 6 || y == 6) /* timing */
+                                continue;
+
+                        if (x < 9 && y < 9) /* top-left */
+                                continue;
+
+                        if (x >= dim - 8 && y < 9) /* top-right */
+                                continue;
+
+                        if (x < 9 && y >= dim - 8) /* bottom-left */
+                                continue;
+
+                        /* version info */
+                        if (tpl->version >= 7) {
+                                if (y < 6 && x >= dim - 11)
+                                        continue;
+                                if (x < 6 && y >= dim - 11)
+                                        continue;
+                        }
+
+                        setpx(tpl->mask, s, x, y);
+                }
+        }
+
+        /* Alignment pattern */
+        for (y = 0; y < am_side; ++y) {
+                for (x = 0; x < am_side; ++x) {
+                        if ((x == 0 && y == 0) ||
+                            (x == 0 && y == am_side - 1) ||
+                            (x == am_side - 1 && y == 0))
+                                continue;
+
+                        for (j = -2; j <= 2; ++j)
+                                for (i = -2; i <= 2; ++i)
+                                        clearpx(tpl->mask, s,
+                                                am_pos[x] + i, am_pos[y] + j);
+                }
+        }
+}
+
+static void draw_format(unsigned char * bits, size_t stride, int dim,
+                        unsigned int format)
+{
+        int i;
+
+        for (i = 0; i < 8; ++i) {
+                if (format & 0x1) {
+                        setpx(bits, stride, 8, i + (i > 5));
+                        setpx(bits, stride, dim - 1 - i, 8);
+                }
+                format >>= 1;
+        }
+
+        for (i = 0; i < 7; ++i) {
+                if (format & 0x1) {
+                        setpx(bits, stride, 8, dim - 7 + i);
+                        setpx(bits, stride, 6 - i + (i == 0), 8);
+                }
+                format >>= 1;
+        }
+}
+
+/* Draw every format word onto a blank page to find the bytes the
+ * format info touches, and what each word puts in them.
+ */
+static int make_format_overlays(struct qr_template * tpl, size_t size)
+{
+        unsigned char * scratch;
+        size_t off;
+        int f, n;
+
+        scratch = calloc(1, size);
+        if (!scratch)
+                return -1;
+
+        draw_format(scratch, tpl->stride, tpl->width, 0x7FFF);
+
+        n = 0;
+        for (off = 0; off < size; ++off) {
+                if (!scratch[off])
+                        continue;
+                assert(n < QR_FORMAT_BYTES);
+                tpl->format_offset[n++] = off;
+        }
+        tpl->format_count = n;
+
+        for (f = 0; f < 32; ++f) {
+                memset(scratch, 0, size);
+                draw_format(scratch, tpl->stride, tpl->width,
+                            QR_FORMAT_BITS[f]);
+                for (n = 0; n < tpl->format_count; ++n)
+                        tpl->format_value[f][n] =
+                                scratch[tpl->format_offset[n]];
+        }
+
+        free(scratch);
+
+        return 0;
+}
+
+static struct qr_template * build_template(int version)
+{
+        const struct qr_symbol_plan * geom = QR_GEOMETRY(version);
+        struct qr_template * tpl;
+        size_t size;
+
+        tpl = malloc(sizeof(*tpl));
+        if (!tpl)
+                return 0;
+        tpl->bits = 0;
+
+        tpl->version = version;
+        tpl->width = geom->width;
+        tpl->stride = (geom->width + CHAR_BIT - 1) / CHAR_BIT;
+        size = tpl->stride * tpl->width;
+
+        /* One allocation for both planes */
+        tpl->bits = calloc(2, size);
+        if (!tpl->bits)
+                goto fail;
+        tpl->mask = tpl->bits + size;
+
+        draw_patterns(tpl);
+        draw_mask(tpl);
+        if (make_format_overlays(tpl, size) != 0)
+                goto fail;
+
+        return tpl;
+
+fail:
+        free(tpl->bits);
+        free(tpl);
+        return 0;
+}
+
+/* Never freed */
+static const struct qr_template * templates[40];
+static qr_mutex template_lock = QR_MUTEX_INIT;
+
+const struct qr_template * qr_template_get(int version)
+{
+        const struct qr_template * tpl;
+
+        qr_mutex_lock(&template_lock);
+        if (!templates[version - 1])
+                templates[version - 1] = build_template(version);
+        tpl = templates[version - 1];
+        qr_mutex_unlock(&template_lock);
+
+        return tpl;
+}
+
+void qr_template_draw_format(const struct qr_template * tpl,
+                             unsigned char *            bits,
+                             enum qr_ec_level           ec,
+                             int                        mask)
+{
+        const unsigned char * value =
+                tpl->format_value[(ec & 0x3) << 3 | (mask & 0x7)];
+        int n;
+
+        for (n = 0; n < tpl->format_count; ++n)
+                bits[tpl->format_offset[n]] |= value[n];
+}
+
@@ -2,49 +2,6 @@
 
 /* FIXME: don't like big tables of data */
 
-const int QR_ALIGNMENT_LOCATION[40][7] = {
-        {  0,  0,  0,  0,  0,  0,  0 }, /*  1 */
-        {  6, 18,  0,  0,  0,  0,  0 }, /*  2 */
-        {  6, 22,  0,  0,  0,  0,  0 }, /*  3 */
-        {  6, 26,  0,  0,  0,  0,  0 }, /*  4 */
-        {  6, 30,  0,  0,  0,  0,  0 }, /*  5 */
-        {  6, 34,  0,  0,  0,  0,  0 }, /*  6 */
-        {  6, 22, 38,  0,  0,  0,  0 }, /*  7 */
-        {  6, 24, 42,  0,  0,  0,  0 }, /*  8 */
-        {  6, 26, 46,  0,  0,  0,  0 }, /*  9 */
-        {  6, 28, 50,  0,  0,  0,  0 }, /* 10 */
-        {  6, 30, 54,  0,  0,  0,  0 }, /* 11 */
-        {  6, 32, 58,  0,  0,  0,  0 }, /* 12 */
-        {  6, 34, 62,  0,  0,  0,  0 }, /* 13 */
-        {  6, 26, 46, 66,  0,  0,  0 }, /* 14 */
-        {  6, 26, 48, 70,  0,  0,  0 }, /* 15 */
-        {  6, 26, 50, 74,  0,  0,  0 }, /* 16 */
-        {  6, 30, 54, 78,  0,  0,  0 }, /* 17 */
-        {  6, 30, 56, 82,  0,  0,  0 }, /* 18 */
-        {  6, 30, 58, 86,  0,  0,  0 }, /* 19 */
-        {  6, 34, 62, 90,  0,  0,  0 }, /* 20 */
-        {  6, 28, 50, 72, 94,  0,  0 }, /* 21 */
-        {  6, 26, 50, 74, 98,  0,  0 }, /* 22 */
-        {  6, 30, 54, 78,102,  0,  0 }, /* 23 */
-        {  6, 28, 54, 80,106,  0,  0 }, /* 24 */
-        {  6, 32, 58, 84,110,  0,  0 }, /* 25 */
-        {  6, 30, 58, 86,114,  0,  0 }, /* 26 */
-        {  6, 34, 62, 90,118,  0,  0 }, /* 27 */
-        {  6, 26, 50, 74, 98,122,  0 }, /* 28 */
-        {  6, 30, 54, 78,102,126,  0 }, /* 29 */
-        {  6, 26, 52, 78,104,130,  0 }, /* 30 */
-        {  6, 30, 56, 82,108,134,  0 }, /* 31 */
-        {  6, 34, 60, 86,112,138,  0 }, /* 32 */
-        {  6, 30, 58, 86,114,142,  0 }, /* 33 */
-        {  6, 34, 62, 90,118,146,  0 }, /* 34 */
-        {  6, 30, 54, 78,102,126,150 }, /* 35 */
-        {  6, 24, 50, 76,102,128,154 }, /* 36 */
-        {  6, 28, 54, 80,106,132,158 }, /* 37 */
-        {  6, 32, 58, 84,110,136,162 }, /* 38 */
-        {  6, 26, 54, 82,110,138,166 }, /* 39 */
-        {  6, 30, 58, 86,114,142,170 }, /* 40 */
-};
-
 const int QR_DATA_WORD_COUNT[40][4] = {
         {   19,   16,   13,    9 },
         {   34,   28,   22,   16 },
@@ -76,13 +33,14 @@ const int QR_DATA_WORD_COUNT[40][4] = {
         { 1531, 1193,  871,  661 },
         { 1631, 1267,  911,  701 },
         { 1735, 1373,  985,  745 },
-        { 1845, 1455, 1033,  793 },
+        { 1843, 1455, 1033,  793 },
         { 1955, 1541, 1115,  845 },
         { 2071, 1631, 1171,  901 },
         { 2191, 1725, 1231,  961 },
         { 2306, 1812, 1286,  986 },
-        { 2434, 1914, 1351, 1054 },
+        { 2434, 1914, 1354, 1054 },
         { 2566, 1992, 1426, 1096 },
+        { 2702, 2102, 1502, 1142 },
         { 2812, 2216, 1582, 1222 },
         { 2956, 2334, 1666, 1276 }
 };
@@ -19,11 +19,45 @@ static const unsigned int QR_VERSION_POLY = 0x1F25;
 /* A QR-code word is always 8 bits, but CHAR_BIT might not be */
 static const int QR_WORD_BITS = 8;
 
-extern const int QR_ALIGNMENT_LOCATION[40][7];
+/* Inputs to gentables; use QR_SYMBOL_PLAN (plan.h) instead */
 extern const int QR_DATA_WORD_COUNT[40][4];
-/* See qr_get_rs_block_sizes() */
 extern const int QR_RS_BLOCK_COUNT[40][4][2];
 extern const enum qr_data_type QR_TYPE_CODES[16];
 
+/* The rest are generated by gentables (see tables.c) */
+
+/* Log / antilog tables for GF(256). QR_GF_EXP is doubled up so that
+ * QR_GF_EXP[QR_GF_LOG[a] + QR_GF_LOG[b]] is always a * b (a, b != 0).
+ */
+extern const unsigned char QR_GF_EXP[512];
+extern const unsigned char QR_GF_LOG[256];
+/* QR_GF_NIBBLE_LO[x][i] = x * i, QR_GF_NIBBLE_HI[x][i] = x * (i << 4) */
+extern const unsigned char QR_GF_NIBBLE_LO[256][16];
+extern const unsigned char QR_GF_NIBBLE_HI[256][16];
+/* See rs_generator() */
+extern const unsigned char QR_RS_GENERATOR[31][30];
+
+/* Each byte with its bits in the opposite order */
+extern const unsigned char QR_BIT_REVERSE[256];
+
+/* Shift JIS byte classes for Kanji mode (see gentables) */
+#define QR_SJIS_LEAD    1
+#define QR_SJIS_TRAIL   2
+extern const unsigned char QR_SJIS_CLASS[256];
+
+/* Alphanumeric mode code of each byte, or QR_ALPHA_NONE */
+#define QR_ALPHA_NONE   0xFF
+extern const unsigned char QR_ALPHA_CODE[256];
+
+/* Data mask patterns: QR_MASK_ROWS[mask][row % 12] is the row packed
+ * as in qr_bitmap, for symbols up to 23 bytes (184 modules) wide
+ */
+extern const unsigned char QR_MASK_ROWS[8][12][23];
+
+/* Masked format info, indexed by (ec << 3) | mask */
+extern const unsigned int QR_FORMAT_BITS[32];
+/* Version info (0 below version 7) */
+extern const unsigned long QR_VERSION_BITS[40];
+
 #endif
 
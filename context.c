@@ -0,0 +1,189 @@
+/**
+ * Encode contexts: a list of blocks, allocated from in order. The
+ * first block is the caller's buffer, if there was one. Resetting
+ * just rewinds to the first block; later blocks are reused as the
+ * allocations reach them again, and new ones are only added when an
+ * allocation does not fit in what is already there.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <qr/context.h>
+
+#include "alloc.h"
+
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+
+/* Size of the first block when the context has to grow by itself */
+#define QR_CONTEXT_BLOCK 16384
+
+#define ALIGN(n) QR_ALIGN(n)
+
+struct qr_block {
+        struct qr_block * next;
+        size_t            size;  /* bytes of data */
+        size_t            used;
+        int               owned; /* from the heap */
+};
+
+#define BLOCK_HEADER ALIGN(sizeof(struct qr_block))
+#define BLOCK_DATA(b) ((unsigned char *) (b) + BLOCK_HEADER)
+
+struct qr_context {
+        struct qr_block * head;
+        struct qr_block * current;
+        unsigned char *   last;  /* latest allocation */
+        int               owned; /* from the heap */
+};
+
+static struct qr_block * block_create(size_t size)
+{
+        struct qr_block * block;
+
+        block = qr_heap_alloc(BLOCK_HEADER + size);
+        if (block) {
+                block->next  = 0;
+                block->size  = size;
+                block->used  = 0;
+                block->owned = 1;
+        }
+
+        return block;
+}
+
+struct qr_context * qr_context_create(void * buffer, size_t size)
+{
+        const size_t header = ALIGN(sizeof(struct qr_context));
+        struct qr_context * ctx;
+        struct qr_block * head;
+
+        if (buffer) {
+                if (size < header + BLOCK_HEADER)
+                        return 0;
+
+                ctx = buffer;
+                ctx->owned = 0;
+
+                head = (struct qr_block *) ((unsigned char *) buffer + header);
+                head->next  = 0;
+                head->size  = size - header - BLOCK_HEADER;
+                head->used  = 0;
+                head->owned = 0;
+        } else {
+                ctx = qr_heap_alloc(sizeof(*ctx));
+                if (!ctx)
+                        return 0;
+                ctx->owned = 1;
+
+                head = block_create(QR_CONTEXT_BLOCK);
+                if (!head) {
+                        qr_heap_free(ctx);
+                        return 0;
+                }
+        }
+
+        ctx->head = ctx->current = head;
+        ctx->last = 0;
+
+        return ctx;
+}
+
+void qr_context_reset(struct qr_context * ctx)
+{
+        ctx->current = ctx->head;
+        ctx->head->used = 0;
+        ctx->last = 0;
+}
+
+void qr_context_destroy(struct qr_context * ctx)
+{
+        struct qr_block * block, * next;
+
+        if (!ctx)
+                return;
+
+        for (block = ctx->head; block; block = next) {
+                next = block->next;
+                if (block->owned)
+                        qr_heap_free(block);
+        }
+
+        if (ctx->owned)
+                qr_heap_free(ctx);
+}
+
+void * qr_alloc(struct qr_context * ctx, size_t size)
+{
+        struct qr_block * block;
+        unsigned char * p;
+
+        if (!ctx)
+                return qr_heap_alloc(size);
+
+        size = ALIGN(MAX(size, 1));
+        block = ctx->current;
+
+        while (block->size - block->used < size) {
+                struct qr_block * next = block->next;
+
+                if (!next || next->size < size) {
+                        next = block_create(MAX(size, block->size * 2));
+                        if (!next)
+                                return 0;
+                        next->next = block->next;
+                        block->next = next;
+                }
+
+                next->used = 0;
+                block = next;
+        }
+
+        ctx->current = block;
+        p = BLOCK_DATA(block) + block->used;
+        block->used += size;
+        ctx->last = p;
+
+        return p;
+}
+
+void * qr_realloc(struct qr_context * ctx, void * ptr,
+                  size_t old_size, size_t size)
+{
+        void * p;
+
+        if (!ctx)
+                return qr_heap_realloc(ptr, size);
+
+        /* The latest allocation can grow in place */
+        if (ptr && ptr == ctx->last) {
+                struct qr_block * block = ctx->current;
+                size_t start = ctx->last - BLOCK_DATA(block);
+
+                if (block->size - start >= ALIGN(MAX(size, 1))) {
+                        block->used = start + ALIGN(MAX(size, 1));
+                        return ptr;
+                }
+        }
+
+        p = qr_alloc(ctx, size);
+        if (p && ptr)
+                memcpy(p, ptr, MIN(old_size, size));
+
+        return p;
+}
+
+void qr_free(struct qr_context * ctx, void * ptr)
+{
+        if (!ctx) {
+                qr_heap_free(ptr);
+                return;
+        }
+
+        if (ptr && ptr == ctx->last) {
+                ctx->current->used = ctx->last - BLOCK_DATA(ctx->current);
+                ctx->last = 0;
+        }
+}
+
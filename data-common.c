@@ -3,36 +3,58 @@
 #include <qr/bitstream.h>
 #include <qr/data.h>
 
+#include "alloc.h"
+#include "constants.h"
+#include "kanji.h"
+#include "plan.h"
+
 void qr_data_destroy(struct qr_data * data)
 {
         qr_bitstream_destroy(data->bits);
-        free(data);
+        qr_free(data->ctx, data);
 }
 
 size_t qr_data_size_field_length(int version, enum qr_data_type type)
 {
-        static const size_t QR_SIZE_LENGTHS[3][4] = {
-                { 10,  9,  8,  8 },
-                { 12, 11, 16, 10 },
-                { 14, 13, 16, 12 }
-        };
-        int row, col;
+        int col;
 
         switch (type) {
-        case QR_DATA_NUMERIC:   col = 0; break;
-        case QR_DATA_ALPHA:     col = 1; break;
-        case QR_DATA_8BIT:      col = 2; break;
-        case QR_DATA_KANJI:     col = 3; break;
+        case QR_DATA_NUMERIC:   col = QR_SIZE_FIELD_NUMERIC; break;
+        case QR_DATA_ALPHA:     col = QR_SIZE_FIELD_ALPHA; break;
+        case QR_DATA_8BIT:      col = QR_SIZE_FIELD_8BIT; break;
+        case QR_DATA_KANJI:     col = QR_SIZE_FIELD_KANJI; break;
         default:                return 0;
         }
 
-        if (version < 10)
-                row = 0;
-        else if (version < 27)
-                row = 1;
-        else
-                row = 2;
+        return QR_GEOMETRY(version)->size_field[col];
+}
+
+int qr_kanji_value(unsigned char lead, unsigned char trail)
+{
+        unsigned int c;
+
+        if (!(QR_SJIS_CLASS[lead] & QR_SJIS_LEAD) ||
+            !(QR_SJIS_CLASS[trail] & QR_SJIS_TRAIL))
+                return -1;
+
+        c = (lead << 8) | trail;
+        if (c > 0xEBBF)
+                return -1;
 
-        return QR_SIZE_LENGTHS[row][col];
+        c -= (c <= 0x9FFC) ? 0x8140 : 0xC140;
+
+        return (c >> 8) * 0xC0 + (c & 0xFF);
 }
 
+int qr_kanji_bytes(unsigned int value, unsigned char * out)
+{
+        unsigned int c = ((value / 0xC0) << 8) | (value % 0xC0);
+
+        c += (c < 0x1F00) ? 0x8140 : 0xC140;
+
+        out[0] = c >> 8;
+        out[1] = c & 0xFF;
+
+        /* Not every 13-bit value lands on a valid lead / trail pair */
+        return qr_kanji_value(out[0], out[1]) == (int) value ? 0 : -1;
+}
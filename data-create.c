@@ -2,12 +2,17 @@
  * Not "pure" C - only works with ASCII
  */
 
-#include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 
 #include <qr/bitstream.h>
+#include <qr/context.h>
 #include <qr/data.h>
+#include "alloc.h"
 #include "constants.h"
+#include "kanji.h"
+#include "plan.h"
+#include "segment.h"
 
 static void write_type_and_length(struct qr_data *  data,
                                   enum qr_data_type type,
@@ -18,11 +23,45 @@ static void write_type_and_length(struct qr_data *  data,
                 qr_data_size_field_length(data->version, type));
 }
 
+static int is_digit(unsigned char c)
+{
+        return c >= '0' && c <= '9';
+}
+
+/* Alphanumeric mode takes lower case letters too, as upper case, but
+ * they only count as alphanumeric where the choice is ours
+ */
+static int is_alpha(unsigned char c)
+{
+        return QR_ALPHA_CODE[c] != QR_ALPHA_NONE && (c < 'a' || c > 'z');
+}
+
+/* Groups are converted a batch at a time, then packed in together */
+#define GROUP_BATCH 64
+
+/* The value of the n digits at input, or -1 if they are not all digits */
+static int digits_value(const unsigned char * input, size_t n)
+{
+        int x = 0;
+
+        while (n--) {
+                unsigned int d = (unsigned int) *input++ - '0';
+
+                if (d > 9)
+                        return -1;
+                x = x * 10 + d;
+        }
+
+        return x;
+}
+
 static struct qr_data * encode_numeric(struct qr_data * data,
                                        const unsigned char * input,
                                        size_t           length)
 {
         struct qr_bitstream * stream = data->bits;
+        qr_group_kernel kernel = qr_numeric_simd_kernel();
+        unsigned int group[GROUP_BATCH];
         size_t bits;
 
         bits = 4 + qr_data_size_field_length(data->version, QR_DATA_NUMERIC)
@@ -35,67 +74,42 @@ static struct qr_data * encode_numeric(struct qr_data * data,
 
         write_type_and_length(data, QR_DATA_NUMERIC, length);
 
-        for (; length >= 3; length -= 3) {
-                unsigned int x;
+        while (length >= 3) {
+                size_t n = length / 3 < GROUP_BATCH ? length / 3 : GROUP_BATCH;
+                size_t i = kernel ? kernel(input, 3 * n, group) / 3 : 0;
 
-                if (!isdigit(input[0]) ||
-                    !isdigit(input[1]) ||
-                    !isdigit(input[2]))
-                        return 0;
+                for (; i < n; ++i) {
+                        int x = digits_value(input + 3 * i, 3);
 
-                x = (input[0] - '0') * 100
-                  + (input[1] - '0') * 10
-                  + (input[2] - '0');
-                qr_bitstream_write(stream, x, 10);
-                input += 3;
+                        if (x < 0)
+                                return 0;
+                        group[i] = x;
+                }
+
+                qr_bitstream_pack(stream, group, n, 10);
+                input += 3 * n;
+                length -= 3 * n;
         }
 
         if (length > 0) {
-                unsigned int x;
+                int x = digits_value(input, length);
 
-                if (!isdigit(*input))
+                if (x < 0)
                         return 0;
 
-                x = *input++ - '0';
-
-                if (length == 2) {
-                        if (!isdigit(*input))
-                                return 0;
-                        x = x * 10 + (*input - '0');
-                }
-
                 qr_bitstream_write(stream, x, length == 2 ? 7 : 4);
         }
 
         return data;
 }
 
-static int get_alpha_code(char c)
-{
-        if (isdigit(c))
-                return c - '0';
-        else if (isalpha(c))
-                return toupper(c) - 'A' + 10;
-
-        switch (c) {
-        case ' ': return 36;
-        case '$': return 37;
-        case '%': return 38;
-        case '*': return 39;
-        case '+': return 40;
-        case '-': return 41;
-        case '.': return 42;
-        case '/': return 43;
-        case ':': return 44;
-        default:  return -1;
-        }
-}
-
 static struct qr_data * encode_alpha(struct qr_data * data,
                                      const unsigned char * input,
                                      size_t           length)
 {
         struct qr_bitstream * stream = data->bits;
+        qr_group_kernel kernel = qr_alpha_simd_kernel();
+        unsigned int group[GROUP_BATCH];
         size_t bits;
 
         bits = 4 + qr_data_size_field_length(data->version, QR_DATA_ALPHA)
@@ -108,24 +122,28 @@ static struct qr_data * encode_alpha(struct qr_data * data,
 
         write_type_and_length(data, QR_DATA_ALPHA, length);
 
-        for (; length >= 2; length -= 2) {
-                unsigned int x;
-                int c1, c2;
+        while (length >= 2) {
+                size_t n = length / 2 < GROUP_BATCH ? length / 2 : GROUP_BATCH;
+                size_t i = kernel ? kernel(input, 2 * n, group) / 2 : 0;
 
-                c1 = get_alpha_code(*input++);
-                c2 = get_alpha_code(*input++);
+                for (; i < n; ++i) {
+                        unsigned int c1 = QR_ALPHA_CODE[input[2 * i]];
+                        unsigned int c2 = QR_ALPHA_CODE[input[2 * i + 1]];
 
-                if (c1 < 0 || c2 < 0)
-                        return 0;
+                        if (c1 == QR_ALPHA_NONE || c2 == QR_ALPHA_NONE)
+                                return 0;
+                        group[i] = c1 * 45 + c2;
+                }
 
-                x = c1 * 45 + c2;
-                qr_bitstream_write(stream, x, 11);
+                qr_bitstream_pack(stream, group, n, 11);
+                input += 2 * n;
+                length -= 2 * n;
         }
 
         if (length > 0) {
-                int c = get_alpha_code(*input);
+                unsigned int c = QR_ALPHA_CODE[*input];
 
-                if (c < 0)
+                if (c == QR_ALPHA_NONE)
                         return 0;
 
                 qr_bitstream_write(stream, c, 6);
@@ -151,17 +169,51 @@ static struct qr_data * encode_8bit(struct qr_data * data,
 
         write_type_and_length(data, QR_DATA_8BIT, length);
 
-        while (length--)
-                qr_bitstream_write(stream, *input++, 8);
+        if (qr_bitstream_write_bytes(stream, input, length) != 0)
+                return 0;
 
         return data;
 }
 
+/* Kanji input is Shift JIS, two bytes to a character */
 static struct qr_data * encode_kanji(struct qr_data * data,
                                      const unsigned char * input,
                                      size_t           length)
 {
-        return 0;
+        struct qr_bitstream * stream = data->bits;
+        unsigned int group[GROUP_BATCH];
+        size_t bits, chars = length / 2;
+
+        if (length % 2 != 0)
+                return 0;
+
+        bits = 4 + qr_data_size_field_length(data->version, QR_DATA_KANJI)
+                 + qr_data_dpart_length(QR_DATA_KANJI, chars);
+
+        if (qr_bitstream_resize(stream,
+                        qr_bitstream_size(stream) + bits) != 0)
+                return 0;
+
+        write_type_and_length(data, QR_DATA_KANJI, chars);
+
+        while (chars > 0) {
+                size_t n = chars < GROUP_BATCH ? chars : GROUP_BATCH;
+                size_t i;
+
+                for (i = 0; i < n; ++i) {
+                        int x = qr_kanji_value(input[2 * i], input[2 * i + 1]);
+
+                        if (x < 0)
+                                return 0;
+                        group[i] = x;
+                }
+
+                qr_bitstream_pack(stream, group, n, QR_KANJI_BITS);
+                input += 2 * n;
+                chars -= n;
+        }
+
+        return data;
 }
 
 static int calc_min_version(enum qr_data_type type,
@@ -171,26 +223,298 @@ static int calc_min_version(enum qr_data_type type,
         size_t dbits;
         int version;
 
+        if (type == QR_DATA_KANJI)
+                length /= 2;
+
         dbits = qr_data_dpart_length(type, length);
 
         for (version = 1; version <= 40; ++version) {
                 if (4 + dbits + qr_data_size_field_length(version, type)
-                    < 8 * (size_t) QR_DATA_WORD_COUNT[version - 1][ec ^ 0x1])
+                    < 8 * (size_t) QR_PLAN(version, ec)->data_words)
                         return version;
         }
 
         return -1;
 }
 
+/* Mixed mode: the input is split into runs of the types that take
+ * the fewest bits overall, counting the type and length header each
+ * run costs. This is a shortest path over the input: for each
+ * position and type, the cheapest encoding of the input so far that
+ * ends in a run of that type, where a run may switch type after any
+ * character at the cost of rounding its bits up and a new header.
+ * Costs are in sixths of a bit, which makes every type's cost per
+ * character whole. Kanji characters take two bytes of the input.
+ */
+#define MIXED_TYPES 4
+
+static const enum qr_data_type mixed_type[MIXED_TYPES] = {
+        QR_DATA_NUMERIC, QR_DATA_ALPHA, QR_DATA_8BIT, QR_DATA_KANJI
+};
+
+static const long mixed_cost[MIXED_TYPES] = { 20, 33, 48, 78 };
+static const int mixed_width[MIXED_TYPES] = { 1, 1, 1, 2 };
+
+#define NO_COST LONG_MAX
+
+/* Can the character ending at input[i] (of width 1 or 2) be type t? */
+static int mixed_can_encode(int t, const unsigned char * input, size_t i)
+{
+        const unsigned char c = input[i];
+
+        switch (mixed_type[t]) {
+        case QR_DATA_NUMERIC:   return is_digit(c);
+        case QR_DATA_ALPHA:     return is_alpha(c);
+        case QR_DATA_KANJI:     return i > 0 &&
+                                       qr_kanji_value(input[i - 1], c) >= 0;
+        default:                return 1;
+        }
+}
+
+/* Choose a type for each byte (into run), for the size fields of the
+ * given version, using from for (length + 1) * MIXED_TYPES bytes and
+ * cost for 3 * MIXED_TYPES longs of working space. Returns the total
+ * bits.
+ */
+static long segment(int                   version,
+                    const unsigned char * input,
+                    size_t                length,
+                    unsigned char *       from,
+                    long                  cost[][MIXED_TYPES],
+                    unsigned char *       run)
+{
+        long enc[MIXED_TYPES], head[MIXED_TYPES];
+        size_t i, k;
+        int t, u, best;
+
+        /* cost[i % 3] is for the first i bytes */
+        for (t = 0; t < MIXED_TYPES; ++t) {
+                head[t] = 6 * (4 + (long) qr_data_size_field_length(
+                                        version, mixed_type[t]));
+                cost[0][t] = head[t];
+                from[t] = t;
+        }
+
+        for (i = 1; i <= length; ++i) {
+                long * c = cost[i % 3];
+                unsigned char * f = from + i * MIXED_TYPES;
+
+                /* The character ending here on the end of a run... */
+                for (t = 0; t < MIXED_TYPES; ++t) {
+                        const size_t w = mixed_width[t];
+                        const long * before = cost[(i + 3 - w) % 3];
+
+                        enc[t] = NO_COST;
+                        if (i >= w && before[t] != NO_COST &&
+                            mixed_can_encode(t, input, i - 1))
+                                enc[t] = before[t] + mixed_cost[t];
+                        c[t] = enc[t];
+                        f[t] = t;
+                }
+
+                /* ... and then perhaps the start of another */
+                for (t = 0; t < MIXED_TYPES; ++t) {
+                        for (u = 0; u < MIXED_TYPES; ++u) {
+                                long x;
+
+                                if (u == t || enc[u] == NO_COST)
+                                        continue;
+
+                                x = (enc[u] + 5) / 6 * 6 + head[t];
+                                if (x < c[t]) {
+                                        c[t] = x;
+                                        f[t] = u;
+                                }
+                        }
+                }
+        }
+
+        best = 0;
+        for (t = 1; t < MIXED_TYPES; ++t)
+                if (cost[length % 3][t] < cost[length % 3][best])
+                        best = t;
+
+        /* Back from the end: the run a position ends is from[], and
+         * its last character goes back by that type's width
+         */
+        for (t = best, i = length; i > 0; ) {
+                t = from[i * MIXED_TYPES + t];
+                for (k = 0; k < (size_t) mixed_width[t]; ++k)
+                        run[--i] = t;
+        }
+
+        return (cost[length % 3][best] + 5) / 6;
+}
+
+static struct qr_data * encode_mixed(struct qr_data *      data,
+                                     const unsigned char * input,
+                                     size_t                length,
+                                     const unsigned char * run)
+{
+        size_t start, end;
+
+        for (start = 0; start < length; start = end) {
+                const enum qr_data_type type = mixed_type[run[start]];
+                struct qr_data * ret;
+
+                for (end = start + 1; end < length; ++end)
+                        if (run[end] != run[start])
+                                break;
+
+                /* Too long for the size field means it cannot fit */
+                if ((end - start) / mixed_width[run[start]]
+                    >> qr_data_size_field_length(data->version, type))
+                        return 0;
+
+                switch (type) {
+                case QR_DATA_NUMERIC:
+                        ret = encode_numeric(data, input + start, end - start);
+                        break;
+                case QR_DATA_ALPHA:
+                        ret = encode_alpha(data, input + start, end - start);
+                        break;
+                case QR_DATA_KANJI:
+                        ret = encode_kanji(data, input + start, end - start);
+                        break;
+                default:
+                        ret = encode_8bit(data, input + start, end - start);
+                        break;
+                }
+
+                if (!ret)
+                        return 0;
+        }
+
+        return data;
+}
+
+static struct qr_data * create_mixed(struct qr_context *   ctx,
+                                     int                   version,
+                                     enum qr_ec_level      ec,
+                                     const unsigned char * input,
+                                     size_t                length)
+{
+        struct qr_data * data = 0;
+        unsigned char * from, * run;
+        long (* cost)[MIXED_TYPES];
+        long bits = 0;
+        int v;
+
+        if (length == 0)
+                return qr_data_create_ctx(ctx, version, ec, QR_DATA_8BIT,
+                                          (const char *) input, 0);
+
+        cost = qr_alloc(ctx, 3 * sizeof(*cost));
+        from = qr_alloc(ctx, (length + 1) * MIXED_TYPES);
+        run = qr_alloc(ctx, length);
+        if (!cost || !from || !run)
+                goto exit;
+
+        /* The size fields (and so the best split) only change at
+         * versions 10 and 27
+         */
+        for (v = version ? version : 1; v <= 40; ++v) {
+                if (v == version || v == 1 || v == 10 || v == 27)
+                        bits = segment(v, input, length, from, cost, run);
+
+                if (bits <= 8 * (long) QR_PLAN(v, ec)->data_words)
+                        break;
+                if (version)
+                        goto exit;
+        }
+        if (v > 40)
+                goto exit;
+
+        data = qr_alloc(ctx, sizeof(*data));
+        if (!data)
+                goto exit;
+
+        data->version = v;
+        data->ec      = ec;
+        data->bits    = qr_bitstream_create_in(ctx);
+        data->offset  = 0;
+        data->ctx     = ctx;
+
+        if (!data->bits) {
+                qr_free(ctx, data);
+                data = 0;
+        } else if (qr_bitstream_resize(data->bits, bits) != 0 ||
+                   !encode_mixed(data, input, length, run)) {
+                qr_data_destroy(data);
+                data = 0;
+        }
+
+exit:
+        qr_free(ctx, run);
+        qr_free(ctx, from);
+        qr_free(ctx, cost);
+
+        return data;
+}
+
+enum qr_data_type qr_data_classify(const char * input, size_t length)
+{
+        const unsigned char * in = (const unsigned char *) input;
+        qr_classify_kernel kernel = qr_classify_simd_kernel();
+        unsigned int classes;
+        size_t i;
+
+        if (length == 0)
+                return QR_DATA_8BIT;
+
+        classes = QR_CLASS_NUMERIC | QR_CLASS_ALPHA;
+        if (length % 2 == 0)
+                classes |= QR_CLASS_KANJI;
+
+        i = kernel ? kernel(in, length, &classes) : 0;
+
+        for (; classes != 0 && i < length; ++i) {
+                if (!is_digit(in[i]))
+                        classes &= ~QR_CLASS_NUMERIC;
+                if (!is_alpha(in[i]))
+                        classes &= ~QR_CLASS_ALPHA;
+                if ((classes & QR_CLASS_KANJI) && i % 2 == 0 &&
+                    qr_kanji_value(in[i], in[i + 1]) < 0)
+                        classes &= ~QR_CLASS_KANJI;
+        }
+
+        /* Numeric input is alphanumeric too, and Kanji is neither */
+        if (classes & QR_CLASS_NUMERIC)
+                return QR_DATA_NUMERIC;
+        if (classes & QR_CLASS_ALPHA)
+                return QR_DATA_ALPHA;
+        if (classes & QR_CLASS_KANJI)
+                return QR_DATA_KANJI;
+
+        return QR_DATA_8BIT;
+}
+
 struct qr_data * qr_data_create(int               version,
                                 enum qr_ec_level  ec,
                                 enum qr_data_type type,
                                 const char *      input,
                                 size_t            length)
+{
+        return qr_data_create_ctx(0, version, ec, type, input, length);
+}
+
+struct qr_data * qr_data_create_ctx(struct qr_context * ctx,
+                                    int                 version,
+                                    enum qr_ec_level    ec,
+                                    enum qr_data_type   type,
+                                    const char *        input,
+                                    size_t              length)
 {
         struct qr_data * data;
         int minver;
 
+        if (type == QR_DATA_AUTO)
+                type = qr_data_classify(input, length);
+
+        if (type == QR_DATA_MIXED)
+                return create_mixed(ctx, version, ec,
+                                    (const unsigned char *) input, length);
+
         minver = calc_min_version(type, ec, length);
 
         if (version == 0)
@@ -199,14 +523,15 @@ struct qr_data * qr_data_create(int               version,
         if (minver < 0 || version < minver)
                 return 0;
 
-        data = malloc(sizeof(*data));
+        data = qr_alloc(ctx, sizeof(*data));
         if (!data)
                 return 0;
 
         data->version = version;
         data->ec      = ec;
-        data->bits   = qr_bitstream_create();
+        data->bits   = qr_bitstream_create_in(ctx);
         data->offset = 0;
+        data->ctx    = ctx;
 
         if (data->bits) {
                 struct qr_data * ret;
@@ -232,12 +557,12 @@ struct qr_data * qr_data_create(int               version,
 
                 if (!ret) {
                         qr_bitstream_destroy(data->bits);
-                        free(data);
+                        qr_free(ctx, data);
                 }
 
                 return ret;
         } else {
-                free(data);
+                qr_free(ctx, data);
                 return 0;
         }
 }
@@ -262,7 +587,8 @@ size_t qr_data_dpart_length(enum qr_data_type type, size_t length)
                 bits = 8 * length;
                 break;
         case QR_DATA_KANJI:
-                /* unsupported */
+                bits = QR_KANJI_BITS * length;
+                break;
         default:
                 /* unsupported; will be ignored */
                 bits = 0;
@@ -1,10 +1,12 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <qr/bitstream.h>
 #include <qr/data.h>
 #include "constants.h"
+#include "kanji.h"
 
 static enum qr_data_type read_data_type(struct qr_bitstream * stream)
 {
@@ -127,9 +129,11 @@ static enum qr_data_type parse_alpha(const struct qr_data * data,
                 chunk = qr_bitstream_read(stream, bits);
                 if (chunk >= 45)
                         goto invalid;
-                *p = charset[chunk];
+                *p++ = charset[chunk];
         }
 
+        *p = '\0';
+
         *output = buffer;
         *length = chars;
 
@@ -174,10 +178,45 @@ static enum qr_data_type parse_8bit(const struct qr_data * data,
         return QR_DATA_8BIT;
 }
 
+/* Kanji comes out as Shift JIS, two bytes to a character */
 static enum qr_data_type parse_kanji(const struct qr_data * data,
                                      char **                output,
                                      size_t *               length)
 {
+        struct qr_bitstream * stream;
+        size_t field_len;
+        unsigned int chars, i;
+        unsigned char * buffer;
+
+        stream = data->bits;
+        buffer = 0;
+
+        field_len = qr_data_size_field_length(data->version, QR_DATA_KANJI);
+        if (qr_bitstream_remaining(stream) < field_len)
+                goto invalid;
+
+        chars = qr_bitstream_read(stream, field_len);
+
+        if (qr_bitstream_remaining(stream) < chars * QR_KANJI_BITS)
+                goto invalid;
+
+        buffer = malloc(2 * chars + 1);
+        if (!buffer)
+                goto invalid;
+
+        for (i = 0; i < chars; ++i)
+                if (qr_kanji_bytes(qr_bitstream_read(stream, QR_KANJI_BITS),
+                                   buffer + 2 * i) != 0)
+                        goto invalid;
+
+        buffer[2 * chars] = '\0';
+
+        *output = (char *) buffer;
+        *length = 2 * chars;
+
+        return QR_DATA_KANJI;
+invalid:
+        free(buffer);
         return QR_DATA_INVALID;
 }
 
@@ -214,16 +253,13 @@ int qr_get_data_length(const struct qr_data * data)
         return (int) qr_bitstream_read(data->bits, field_len);
 }
 
-enum qr_data_type qr_parse_data(const struct qr_data * input,
-                                char **                output,
-                                size_t *               length)
+/* Parse one segment, after its type */
+static enum qr_data_type parse_segment(const struct qr_data * input,
+                                       enum qr_data_type      type,
+                                       char **                output,
+                                       size_t *               length)
 {
-        qr_bitstream_seek(input->bits, input->offset);
-
-        *output = NULL;
-        *length = 0;
-
-        switch (read_data_type(input->bits)) {
+        switch (type) {
         case QR_DATA_NUMERIC:
                 return parse_numeric(input, output, length);
         case QR_DATA_ALPHA:
@@ -238,3 +274,57 @@ enum qr_data_type qr_parse_data(const struct qr_data * input,
         }
 }
 
+/* The segments are joined up, up to the terminator (or the end of
+ * the data); the type is QR_DATA_MIXED if there was more than one.
+ */
+enum qr_data_type qr_parse_data(const struct qr_data * input,
+                                char **                output,
+                                size_t *               length)
+{
+        enum qr_data_type type, result = QR_DATA_INVALID;
+        char * text = 0, * segment, * joined;
+        size_t total = 0, n;
+
+        qr_bitstream_seek(input->bits, input->offset);
+
+        *output = NULL;
+        *length = 0;
+
+        while (qr_bitstream_remaining(input->bits) >= 4) {
+                unsigned int code = qr_bitstream_read(input->bits, 4);
+
+                if (code == 0)
+                        break; /* terminator */
+
+                type = parse_segment(input, QR_TYPE_CODES[code],
+                                     &segment, &n);
+                if (type == QR_DATA_INVALID)
+                        goto invalid;
+
+                if (!text) {
+                        text = segment;
+                        result = type;
+                } else {
+                        joined = realloc(text, total + n + 1);
+                        if (!joined) {
+                                free(segment);
+                                goto invalid;
+                        }
+                        text = joined;
+                        memcpy(text + total, segment, n);
+                        text[total + n] = '\0';
+                        free(segment);
+                        result = QR_DATA_MIXED;
+                }
+                total += n;
+        }
+
+        *output = text;
+        *length = total;
+
+        return result;
+
+invalid:
+        free(text);
+        return QR_DATA_INVALID;
+}
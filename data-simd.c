@@ -0,0 +1,257 @@
+/**
+ * Vectorised segment encoders.
+ *
+ * Each kernel validates a block of input and converts it at once.
+ * Digits and alphanumeric characters are mapped to their codes with
+ * a few range compares (and, for the punctuation, a PSHUFB lookup
+ * on the low nibble); the codes are then combined into group values
+ * with PMADDUBSW, which multiplies neighbouring bytes by their place
+ * values and adds the pairs. Byte mode only needs the bits of each
+ * byte reversed, to match the bitstream's layout, which is two
+ * PSHUFB nibble lookups. The input classifier uses the same range
+ * compares, but only keeps their masks.
+ */
+
+#include "segment.h"
+
+#if !defined(QR_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define QR_X86_SIMD
+#endif
+
+#ifdef QR_X86_SIMD
+
+#include <immintrin.h>
+
+/* Digit triplets spread out to four bytes each, and their weights */
+static const unsigned char DIGIT_ORDER[16] = {
+        0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11, 0x80
+};
+static const unsigned char DIGIT_WEIGHT[16] = {
+        100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0
+};
+
+/* Alphanumeric codes of 0x20 ~ 0x2F, 0xFF for none */
+static const unsigned char ALPHA_PUNCT[16] = {
+        36, 0xFF, 0xFF, 0xFF, 37, 38, 0xFF, 0xFF,
+        0xFF, 0xFF, 39, 40, 0xFF, 41, 42, 43
+};
+
+/* Each nibble with its bits reversed, in the high and low nibble */
+static const unsigned char REVERSE_HI[16] = {
+        0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0,
+        0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0
+};
+static const unsigned char REVERSE_LO[16] = {
+        0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+        0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+
+#define LOAD(p) _mm_loadu_si128((const __m128i *) (p))
+
+/* Bytes of x that are at most n, as 0xFF */
+#define AT_MOST(x, n) \
+        _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8((char) (n))), x)
+
+/* Bytes of x in lo ... hi, as bits of a mask */
+#define IN_RANGE(x, lo, hi) _mm_movemask_epi8( \
+        AT_MOST(_mm_sub_epi8(x, _mm_set1_epi8((char) (lo))), (hi) - (lo)))
+
+__attribute__((target("ssse3")))
+static size_t numeric_ssse3(const unsigned char * in,
+                            size_t                length,
+                            unsigned int *        out)
+{
+        const __m128i order = LOAD(DIGIT_ORDER);
+        const __m128i weight = LOAD(DIGIT_WEIGHT);
+        const __m128i ones = _mm_set1_epi16(1);
+        size_t done = 0;
+
+        /* Twelve digits (four groups) from each sixteen bytes */
+        while (length - done >= 16) {
+                __m128i d = _mm_sub_epi8(LOAD(in + done), _mm_set1_epi8('0'));
+
+                if ((_mm_movemask_epi8(AT_MOST(d, 9)) & 0xFFF) != 0xFFF)
+                        break;
+
+                d = _mm_maddubs_epi16(_mm_shuffle_epi8(d, order), weight);
+                d = _mm_madd_epi16(d, ones);
+                _mm_storeu_si128((__m128i *) (out + done / 3), d);
+
+                done += 12;
+        }
+
+        return done;
+}
+
+__attribute__((target("ssse3")))
+static size_t alpha_ssse3(const unsigned char * in,
+                          size_t                length,
+                          unsigned int *        out)
+{
+        const __m128i punct = LOAD(ALPHA_PUNCT);
+        const __m128i weight = _mm_set1_epi16(45 | 1 << 8);
+        const __m128i zero = _mm_setzero_si128();
+        size_t done = 0;
+
+        while (length - done >= 16) {
+                const __m128i v = LOAD(in + done);
+                __m128i d, u, p, dm, um, pm, cm, code;
+
+                /* Digits, letters of either case, 0x20 ~ 0x2F and ':' */
+                d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+                u = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                                 _mm_set1_epi8('a'));
+                p = _mm_sub_epi8(v, _mm_set1_epi8(0x20));
+                dm = AT_MOST(d, 9);
+                um = AT_MOST(u, 25);
+                pm = AT_MOST(p, 15);
+                cm = _mm_cmpeq_epi8(v, _mm_set1_epi8(':'));
+
+                code = _mm_or_si128(
+                        _mm_or_si128(_mm_and_si128(dm, d),
+                                     _mm_and_si128(um, _mm_add_epi8(u,
+                                                   _mm_set1_epi8(10)))),
+                        _mm_or_si128(_mm_and_si128(pm,
+                                                   _mm_shuffle_epi8(punct, p)),
+                                     _mm_and_si128(cm, _mm_set1_epi8(44))));
+                code = _mm_or_si128(code, _mm_andnot_si128(
+                        _mm_or_si128(_mm_or_si128(dm, um), _mm_or_si128(pm, cm)),
+                        _mm_set1_epi8(-1)));
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(code,
+                                                     _mm_set1_epi8(-1))))
+                        break;
+
+                code = _mm_maddubs_epi16(code, weight);
+                _mm_storeu_si128((__m128i *) (out + done / 2),
+                                 _mm_unpacklo_epi16(code, zero));
+                _mm_storeu_si128((__m128i *) (out + done / 2 + 4),
+                                 _mm_unpackhi_epi16(code, zero));
+
+                done += 16;
+        }
+
+        return done;
+}
+
+__attribute__((target("ssse3")))
+static size_t reverse_ssse3(const unsigned char * in,
+                            size_t                length,
+                            unsigned char *       out)
+{
+        const __m128i hi = LOAD(REVERSE_HI);
+        const __m128i lo = LOAD(REVERSE_LO);
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        size_t done;
+
+        for (done = 0; length - done >= 16; done += 16) {
+                const __m128i v = LOAD(in + done);
+
+                _mm_storeu_si128((__m128i *) (out + done), _mm_or_si128(
+                        _mm_shuffle_epi8(hi, _mm_and_si128(v, nibble)),
+                        _mm_shuffle_epi8(lo, _mm_and_si128(
+                                _mm_srli_epi16(v, 4), nibble))));
+        }
+
+        return done;
+}
+
+/* Sixteen bytes at a time, with the classes as 16-bit masks: Kanji
+ * needs lead bytes in the even places, trail bytes in the odd ones,
+ * and nothing past 0xEBBF.
+ */
+__attribute__((target("ssse3")))
+static size_t classify_ssse3(const unsigned char * in,
+                             size_t                length,
+                             unsigned int *        classes)
+{
+        const __m128i punct = LOAD(ALPHA_PUNCT);
+        unsigned int c = *classes;
+        size_t done;
+
+        for (done = 0; c != 0 && length - done >= 16; done += 16) {
+                const __m128i v = LOAD(in + done);
+                const int digit = IN_RANGE(v, '0', '9');
+
+                if (digit != 0xFFFF)
+                        c &= ~QR_CLASS_NUMERIC;
+
+                if (c & QR_CLASS_ALPHA) {
+                        const __m128i p = _mm_sub_epi8(v, _mm_set1_epi8(0x20));
+                        int alpha = digit | IN_RANGE(v, 'A', 'Z');
+
+                        alpha |= _mm_movemask_epi8(_mm_andnot_si128(
+                                _mm_cmpeq_epi8(_mm_shuffle_epi8(punct, p),
+                                               _mm_set1_epi8(-1)),
+                                AT_MOST(p, 15)));
+                        alpha |= _mm_movemask_epi8(
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+
+                        if (alpha != 0xFFFF)
+                                c &= ~QR_CLASS_ALPHA;
+                }
+
+                if (c & QR_CLASS_KANJI) {
+                        const int lead = IN_RANGE(v, 0x81, 0x9F)
+                                       | IN_RANGE(v, 0xE0, 0xEB);
+                        const int trail = IN_RANGE(v, 0x40, 0xFC)
+                                        & ~IN_RANGE(v, 0x7F, 0x7F);
+                        const int top = IN_RANGE(v, 0xEB, 0xEB)
+                                      & IN_RANGE(v, 0xC0, 0xFF) >> 1;
+
+                        if ((lead & 0x5555) != 0x5555 ||
+                            (trail & 0xAAAA) != 0xAAAA ||
+                            (top & 0x5555) != 0)
+                                c &= ~QR_CLASS_KANJI;
+                }
+        }
+
+        *classes = c;
+
+        return done;
+}
+
+qr_group_kernel qr_numeric_simd_kernel(void)
+{
+        return __builtin_cpu_supports("ssse3") ? numeric_ssse3 : 0;
+}
+
+qr_group_kernel qr_alpha_simd_kernel(void)
+{
+        return __builtin_cpu_supports("ssse3") ? alpha_ssse3 : 0;
+}
+
+qr_reverse_kernel qr_reverse_simd_kernel(void)
+{
+        return __builtin_cpu_supports("ssse3") ? reverse_ssse3 : 0;
+}
+
+qr_classify_kernel qr_classify_simd_kernel(void)
+{
+        return __builtin_cpu_supports("ssse3") ? classify_ssse3 : 0;
+}
+
+#else
+
+qr_group_kernel qr_numeric_simd_kernel(void)
+{
+        return 0;
+}
+
+qr_group_kernel qr_alpha_simd_kernel(void)
+{
+        return 0;
+}
+
+qr_reverse_kernel qr_reverse_simd_kernel(void)
+{
+        return 0;
+}
+
+qr_classify_kernel qr_classify_simd_kernel(void)
+{
+        return 0;
+}
+
+#endif
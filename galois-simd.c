@@ -0,0 +1,149 @@
+/**
+ * Vectorised Reed-Solomon encoders.
+ *
+ * The LFSR in rs_encode_block() is kept in one or two vector
+ * registers with the feedback register in the lowest byte, so that
+ * shifting the registers along is a single byte shift. Each input
+ * word x then needs the product of x with every generator
+ * coefficient at once; we get that from two 16-entry tables (x times
+ * each low nibble, and x times each high nibble) which PSHUFB indexes
+ * with the nibbles of the coefficients. Those tables are generated
+ * at build time (QR_GF_NIBBLE_LO / QR_GF_NIBBLE_HI).
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "constants.h"
+#include "galois.h"
+
+#if !defined(QR_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define QR_X86_SIMD
+#endif
+
+#ifdef QR_X86_SIMD
+
+#include <immintrin.h>
+
+/* Split the generator into the nibbles of its coefficients, highest
+ * power first, padded with zeros to 32 entries.
+ */
+static void split_generator(const unsigned char * g,
+                            size_t                n,
+                            unsigned char         lo[32],
+                            unsigned char         hi[32])
+{
+        size_t i;
+
+        memset(lo, 0, 32);
+        memset(hi, 0, 32);
+
+        for (i = 0; i < n; ++i) {
+                lo[i] = g[n - 1 - i] & 0x0F;
+                hi[i] = g[n - 1 - i] >> 4;
+        }
+}
+
+__attribute__((target("ssse3")))
+static void rs_encode_ssse3(const unsigned char * g,
+                            const unsigned char * data,
+                            size_t                data_words,
+                            unsigned char *       ec,
+                            size_t                n)
+{
+        unsigned char glo[32], ghi[32], out[32];
+        __m128i glo0, glo1, ghi0, ghi1;
+        __m128i b0, b1;
+        size_t i;
+
+        assert(n <= 32);
+
+        split_generator(g, n, glo, ghi);
+        glo0 = _mm_loadu_si128((const __m128i *) glo);
+        glo1 = _mm_loadu_si128((const __m128i *) (glo + 16));
+        ghi0 = _mm_loadu_si128((const __m128i *) ghi);
+        ghi1 = _mm_loadu_si128((const __m128i *) (ghi + 16));
+
+        b0 = b1 = _mm_setzero_si128();
+
+        for (i = 0; i < data_words; ++i) {
+                unsigned int x = (_mm_cvtsi128_si32(b0) ^ data[i]) & 0xFF;
+                __m128i tl = _mm_loadu_si128(
+                        (const __m128i *) QR_GF_NIBBLE_LO[x]);
+                __m128i th = _mm_loadu_si128(
+                        (const __m128i *) QR_GF_NIBBLE_HI[x]);
+                __m128i p0, p1;
+
+                p0 = _mm_xor_si128(_mm_shuffle_epi8(tl, glo0),
+                                   _mm_shuffle_epi8(th, ghi0));
+                p1 = _mm_xor_si128(_mm_shuffle_epi8(tl, glo1),
+                                   _mm_shuffle_epi8(th, ghi1));
+
+                b0 = _mm_xor_si128(_mm_alignr_epi8(b1, b0, 1), p0);
+                b1 = _mm_xor_si128(_mm_srli_si128(b1, 1), p1);
+        }
+
+        _mm_storeu_si128((__m128i *) out, b0);
+        _mm_storeu_si128((__m128i *) (out + 16), b1);
+        memcpy(ec, out, n);
+}
+
+__attribute__((target("avx2")))
+static void rs_encode_avx2(const unsigned char * g,
+                           const unsigned char * data,
+                           size_t                data_words,
+                           unsigned char *       ec,
+                           size_t                n)
+{
+        unsigned char glo[32], ghi[32], out[32];
+        __m256i vlo, vhi, b;
+        size_t i;
+
+        assert(n <= 32);
+
+        split_generator(g, n, glo, ghi);
+        vlo = _mm256_loadu_si256((const __m256i *) glo);
+        vhi = _mm256_loadu_si256((const __m256i *) ghi);
+
+        b = _mm256_setzero_si256();
+
+        for (i = 0; i < data_words; ++i) {
+                unsigned int x = (_mm256_extract_epi8(b, 0) ^ data[i]) & 0xFF;
+                __m256i tl = _mm256_broadcastsi128_si256(
+                        _mm_loadu_si128((const __m128i *) QR_GF_NIBBLE_LO[x]));
+                __m256i th = _mm256_broadcastsi128_si256(
+                        _mm_loadu_si128((const __m128i *) QR_GF_NIBBLE_HI[x]));
+                __m256i p, top;
+
+                p = _mm256_xor_si256(_mm256_shuffle_epi8(tl, vlo),
+                                     _mm256_shuffle_epi8(th, vhi));
+
+                /* Shift the whole register down by one byte */
+                top = _mm256_permute2x128_si256(b, b, 0x81);
+                b = _mm256_xor_si256(_mm256_alignr_epi8(top, b, 1), p);
+        }
+
+        _mm256_storeu_si256((__m256i *) out, b);
+        memcpy(ec, out, n);
+}
+
+rs_kernel rs_simd_kernel(void)
+{
+        if (__builtin_cpu_supports("avx2"))
+                return rs_encode_avx2;
+
+        if (__builtin_cpu_supports("ssse3"))
+                return rs_encode_ssse3;
+
+        return 0;
+}
+
+#else
+
+rs_kernel rs_simd_kernel(void)
+{
+        return 0;
+}
+
+#endif
@@ -1,125 +1,228 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <qr/bitstream.h>
+#include "constants.h"
 #include "galois.h"
 
-/* Calculate the residue of a modulo m */
-unsigned long gf_residue(unsigned long a, unsigned long m)
+/* The log / antilog tables are generated at build time; these are
+ * just shorter names for them.
+ */
+#define gf_exp QR_GF_EXP
+#define gf_log QR_GF_LOG
+
+unsigned int gf_mult(unsigned int a, unsigned int b)
 {
-        unsigned long o = 1;
-        int n = 1;
+        if (a == 0 || b == 0)
+                return 0;
 
-        /* Find one past the highest bit of the modulus */
-        while (m & ~(o - 1))
-                o <<= 1;
+        return gf_exp[gf_log[a] + gf_log[b]];
+}
 
-        /* Find the highest n such that O(m * x^n) <= O(a) */
-        while (a & ~(o - 1)) {
-                o <<= 1;
-                ++n;
-        }
+const unsigned char * rs_generator(int k)
+{
+        assert(k > 0 && k <= RS_MAX_EC_WORDS);
 
-        /* For each n, try to reduce a by (m * x^n) */
-        while (n--) {
-                o >>= 1;
+        return QR_RS_GENERATOR[k];
+}
 
-                /* o is the highest bit of (m * x^n) */
-                if (a & o)
-                        a ^= m << n;
+static void rs_encode_scalar(const unsigned char * g,
+                             const unsigned char * data,
+                             size_t                data_words,
+                             unsigned char *       ec,
+                             size_t                n)
+{
+        unsigned char b[RS_MAX_EC_WORDS];
+        unsigned char lg[RS_MAX_EC_WORDS];
+        size_t i, r;
+
+        /* The generator coefficients are never zero, so keep their
+         * logs around and save a lookup per multiplication.
+         */
+        for (r = 0; r < n; ++r) {
+                assert(g[r] != 0);
+                lg[r] = gf_log[g[r]];
+                b[r] = 0;
         }
 
-        return a;
+        /* First, prepare the registers (b) with data bits */
+        for (i = 0; i < data_words; ++i) {
+                unsigned int x = b[n-1] ^ data[i];
+
+                if (x == 0) {
+                        for (r = n-1; r > 0; --r)
+                                b[r] = b[r-1];
+                        b[0] = 0;
+                } else {
+                        unsigned int lx = gf_log[x];
+                        for (r = n-1; r > 0; --r)
+                                b[r] = b[r-1] ^ gf_exp[lg[r] + lx];
+                        b[0] = gf_exp[lg[0] + lx];
+                }
+        }
+
+        /* Read off the registers */
+        for (r = 0; r < n; ++r)
+                ec[r] = b[(n-1)-r];
 }
 
-static unsigned int gf_mult(unsigned int a, unsigned int b)
+void rs_encode_block(const unsigned char * data,
+                     size_t                data_words,
+                     unsigned char *       ec,
+                     size_t                ec_words)
 {
-        /* Reduce modulo x^8 + x^4 + x^3 + x^2 + 1
-         * using the peasant's algorithm
-         */
-        const unsigned int m = 0x11D;
-        unsigned int x = 0;
-        int i;
-
-        for (i = 0; i < 8; ++i) {
-                x ^= (b & 0x1) ? a : 0;
-                a = (a << 1) ^ ((a & 0x80) ? m : 0);
-                b >>= 1;
-        }
+        const unsigned char * g;
+        rs_kernel kernel;
+
+        assert(ec_words > 0 && ec_words <= RS_MAX_EC_WORDS);
+        assert(data_words + ec_words <= RS_MAX_BLOCK_WORDS);
 
-        return x & 0xFF;
+        g = rs_generator(ec_words);
+
+        kernel = rs_simd_kernel();
+        if (kernel)
+                kernel(g, data, data_words, ec, ec_words);
+        else
+                rs_encode_scalar(g, data, data_words, ec, ec_words);
 }
 
-static unsigned int * make_generator(int k)
+static unsigned int gf_div(unsigned int a, unsigned int b)
 {
-        unsigned int * g;
-        unsigned int a;
-        int i, j;
+        assert(b != 0);
 
-        g = calloc(k, sizeof(*g));
-        if (!g)
+        if (a == 0)
                 return 0;
 
-        g[0] = 1; /* Start with g(x) = 1 */
-        a = 1;    /* 2^0 = 1 */
+        return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
 
-        for (i = 0; i < k; ++i) {
-                /* Multiply our poly g(x) by (x + 2^i) */
-                for (j = k - 1; j > 0; --j)
-                        g[j] = gf_mult(g[j], a) ^ g[j-1];
-                g[0] = gf_mult(g[0], a);
+/* Evaluate p(x) = p[0] + p[1] x + ... + p[deg] x^deg */
+static unsigned int gf_poly_eval(const unsigned char * p,
+                                 int                   deg,
+                                 unsigned int          x)
+{
+        unsigned int y = 0;
 
-                a = gf_mult(a, 2);
-        }
+        while (deg >= 0)
+                y = gf_mult(y, x) ^ p[deg--];
 
-        return g;
+        return y;
 }
 
-struct qr_bitstream * rs_generate_words(struct qr_bitstream * data,
-                                        size_t data_words,
-                                        size_t rs_words)
+int rs_correct_block(unsigned char * block,
+                     size_t          length,
+                     size_t          ec_words)
 {
-        struct qr_bitstream * ec = 0;
-        unsigned int * b = 0;
-        unsigned int * g;
-        size_t n = rs_words;
-        size_t i, r;
+        unsigned char check[RS_MAX_EC_WORDS];
+        unsigned char s[RS_MAX_EC_WORDS];
+        unsigned char c[RS_MAX_EC_WORDS + 1];
+        unsigned char b[RS_MAX_EC_WORDS + 1];
+        unsigned char t[RS_MAX_EC_WORDS + 1];
+        unsigned char omega[RS_MAX_EC_WORDS];
+        unsigned char fix[RS_MAX_EC_WORDS / 2];
+        int where[RS_MAX_EC_WORDS / 2];
+        size_t data_words = length - ec_words;
+        unsigned int d, bd;
+        int i, j, n, L, m, roots;
+        int N = ec_words;
+
+        assert(ec_words > 0 && ec_words <= RS_MAX_EC_WORDS);
+        assert(length > ec_words && length <= RS_MAX_BLOCK_WORDS);
+
+        /* A block is error-free exactly when all of its syndromes are
+         * zero, which is the same as its EC words matching a fresh
+         * encoding of its data. Most blocks are clean, and the
+         * encoder is the faster way to find that out.
+         */
+        rs_encode_block(block, data_words, check, ec_words);
+        if (memcmp(check, block + data_words, ec_words) == 0)
+                return 0;
 
-        assert(qr_bitstream_remaining(data) >= data_words * 8);
+        /* Syndromes S_i = r(2^i); block[0] is the highest power */
+        for (i = 0; i < N; ++i) {
+                unsigned int y = 0;
 
-        ec = qr_bitstream_create();
-        if (!ec)
-                return 0;
+                for (j = 0; j < (int) length; ++j) {
+                        if (y != 0)
+                                y = gf_exp[gf_log[y] + i];
+                        y ^= block[j];
+                }
+                s[i] = y;
+        }
 
-        if (qr_bitstream_resize(ec, n * 8) != 0)
-                goto fail;
+        /* Berlekamp-Massey: find the error locator c(x) */
+        memset(c, 0, sizeof(c));
+        memset(b, 0, sizeof(b));
+        c[0] = b[0] = 1;
+        L = 0;
+        m = 1;
+        bd = 1;
+
+        for (n = 0; n < N; ++n) {
+                d = s[n];
+                for (i = 1; i <= L; ++i)
+                        d ^= gf_mult(c[i], s[n - i]);
+
+                if (d == 0) {
+                        ++m;
+                        continue;
+                }
+
+                memcpy(t, c, sizeof(c));
+                for (i = 0; i + m <= N; ++i)
+                        c[i + m] ^= gf_mult(gf_div(d, bd), b[i]);
+
+                if (2 * L <= n) {
+                        L = n + 1 - L;
+                        memcpy(b, t, sizeof(b));
+                        bd = d;
+                        m = 1;
+                } else {
+                        ++m;
+                }
+        }
 
-        b = calloc(n, sizeof(*b));
-        if (!b)
-                goto fail;
+        if (2 * L > N)
+                return -1;
 
-        g = make_generator(n);
-        if (!g)
-                goto fail;
+        /* Error evaluator: omega(x) = S(x) c(x) mod x^N */
+        for (i = 0; i < N; ++i) {
+                omega[i] = 0;
+                for (j = 0; j <= i && j <= L; ++j)
+                        omega[i] ^= gf_mult(c[j], s[i - j]);
+        }
 
-        /* First, prepare the registers (b) with data bits */
-        for (i = 0; i < data_words; ++i) {
-                unsigned int x = b[n-1] ^ qr_bitstream_read(data, 8);
-                for (r = n-1; r > 0; --r)
-                        b[r] = b[r-1] ^ gf_mult(g[r], x);
-                b[0] = gf_mult(g[0], x);
+        /* Chien search for the roots of c(x), working out the size of
+         * each error with Forney's formula as we find it.
+         */
+        roots = 0;
+        for (j = 0; j < (int) length; ++j) {
+                int power = (length - 1) - j;
+                unsigned int xinv = gf_exp[(255 - power) % 255];
+                unsigned int deriv, e;
+
+                if (gf_poly_eval(c, L, xinv) != 0)
+                        continue;
+
+                /* Formal derivative: only the odd terms survive */
+                deriv = 0;
+                for (i = 1; i <= L; i += 2)
+                        deriv ^= gf_mult(c[i], gf_exp[(gf_log[xinv] * (i - 1)) % 255]);
+
+                if (deriv == 0 || roots == L)
+                        return -1;
+
+                e = gf_div(gf_poly_eval(omega, N - 1, xinv), deriv);
+                where[roots] = j;
+                fix[roots] = gf_mult(gf_exp[power], e);
+                ++roots;
         }
 
-        /* Read off the registers */
-        for (r = 0; r < n; ++r)
-                qr_bitstream_write(ec, b[(n-1)-r], 8);
-
-        free(g);
-        free(b);
-        return ec;
-fail:
-        free(b);
-        qr_bitstream_destroy(ec);
-        return 0;
-}
+        if (roots != L)
+                return -1;
 
+        for (i = 0; i < roots; ++i)
+                block[where[i]] ^= fix[i];
+
+        return roots;
+}
@@ -1,11 +1,46 @@
 #ifndef QR_GALOIS_H
 #define QR_GALOIS_H
 
-unsigned long gf_residue(unsigned long a, unsigned long m);
+#include <stddef.h>
 
-struct qr_bitstream * rs_generate_words(struct qr_bitstream * data,
-                                        size_t data_words,
-                                        size_t rs_words);
+/* An RS block never has more than this many EC words (see table 9) */
+#define RS_MAX_EC_WORDS 30
 
-#endif
+/* ... nor more than this many words in total */
+#define RS_MAX_BLOCK_WORDS 255
+
+unsigned int gf_mult(unsigned int a, unsigned int b);
+
+/* Coefficients of the degree-k generator polynomial, lowest first
+ * (the leading x^k term is implicit).
+ */
+const unsigned char * rs_generator(int k);
+
+/* Compute ec_words EC codewords for one block of data. The result
+ * is in transmission order.
+ */
+void rs_encode_block(const unsigned char * data,
+                     size_t                data_words,
+                     unsigned char *       ec,
+                     size_t                ec_words);
 
+/* Check a received block (data words followed by ec_words EC words)
+ * and correct it in place. Returns the number of words corrected, or
+ * -1 if there are too many errors to fix.
+ */
+int rs_correct_block(unsigned char * block,
+                     size_t          length,
+                     size_t          ec_words);
+
+/* Vectorised encoders (galois-simd.c). rs_simd_kernel() returns
+ * the best one the running CPU supports, or 0 if there is none.
+ */
+typedef void (*rs_kernel)(const unsigned char * g,
+                          const unsigned char * data,
+                          size_t                data_words,
+                          unsigned char *       ec,
+                          size_t                ec_words);
+
+rs_kernel rs_simd_kernel(void);
+
+#endif
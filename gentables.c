@@ -0,0 +1,386 @@
+/**
+ * Generates tables.c: everything about QR symbols that can be worked
+ * out ahead of time, so that the library only ever looks it up.
+ *
+ * This runs on the build host, so it must not depend on the library
+ * (only on the data in constants.c).
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "plan.h"
+
+#define RS_MAX_EC_WORDS 30
+
+/* The alphanumeric mode character set, in code order */
+static const char ALPHA_CHARS[] =
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+static unsigned int gf_exp[512];
+static unsigned int gf_log[256];
+
+/* Calculate the residue of a modulo m */
+static unsigned long gf_residue(unsigned long a, unsigned long m)
+{
+        unsigned long o = 1;
+        int n = 1;
+
+        /* Find one past the highest bit of the modulus */
+        while (m & ~(o - 1))
+                o <<= 1;
+
+        /* Find the highest n such that O(m * x^n) <= O(a) */
+        while (a & ~(o - 1)) {
+                o <<= 1;
+                ++n;
+        }
+
+        /* For each n, try to reduce a by (m * x^n) */
+        while (n--) {
+                o >>= 1;
+
+                /* o is the highest bit of (m * x^n) */
+                if (a & o)
+                        a ^= m << n;
+        }
+
+        return a;
+}
+
+static unsigned int gf_mult(unsigned int a, unsigned int b)
+{
+        /* Reduce modulo x^8 + x^4 + x^3 + x^2 + 1
+         * using the peasant's algorithm
+         */
+        const unsigned int m = 0x11D;
+        unsigned int x = 0;
+        int i;
+
+        for (i = 0; i < 8; ++i) {
+                x ^= (b & 0x1) ? a : 0;
+                a = (a << 1) ^ ((a & 0x80) ? m : 0);
+                b >>= 1;
+        }
+
+        return x & 0xFF;
+}
+
+static void make_gf_tables(void)
+{
+        unsigned int x = 1;
+        int i;
+
+        /* gf_exp is doubled up so that a sum of two logs never needs
+         * reducing modulo 255.
+         */
+        for (i = 0; i < 255; ++i) {
+                gf_exp[i] = gf_exp[i + 255] = x;
+                gf_log[x] = i;
+                x = gf_mult(x, 2);
+        }
+        gf_exp[510] = gf_exp[0];
+        gf_exp[511] = gf_exp[1];
+        gf_log[0] = 0; /* undefined */
+}
+
+static void make_generator(int k, unsigned int * g)
+{
+        unsigned int a;
+        int i, j;
+
+        for (i = 0; i < RS_MAX_EC_WORDS; ++i)
+                g[i] = 0;
+
+        g[0] = 1; /* Start with g(x) = 1 */
+        a = 1;    /* 2^0 = 1 */
+
+        for (i = 0; i < k; ++i) {
+                /* Multiply our poly g(x) by (x + 2^i) */
+                for (j = k - 1; j > 0; --j)
+                        g[j] = gf_mult(g[j], a) ^ g[j-1];
+                g[0] = gf_mult(g[0], a);
+
+                a = gf_mult(a, 2);
+        }
+}
+
+static int alignment_side(int version)
+{
+        return version > 1 ? (version / 7) + 2 : 0;
+}
+
+static void alignment_location(int version, int pos[7])
+{
+        int side = alignment_side(version);
+        int dim = version * 4 + 17;
+        int step, i;
+
+        for (i = 0; i < 7; ++i)
+                pos[i] = 0;
+
+        if (side == 0)
+                return;
+
+        /* Evenly spaced from the bottom / right, in steps of an even
+         * number of modules, with the first one always at 6. Version
+         * 32 is the one exception to the rule.
+         */
+        if (version == 32)
+                step = 26;
+        else
+                step = (version * 4 + side * 2 + 1) / (side * 2 - 2) * 2;
+
+        pos[0] = 6;
+        for (i = side - 1; i > 0; --i)
+                pos[i] = dim - 7 - (side - 1 - i) * step;
+}
+
+static long total_capacity(int version)
+{
+        int side = version * 4 + 17;
+
+        int am_side = alignment_side(version);
+
+        int alignment_count = am_side >= 2 ?
+                am_side * am_side - 3 : 0;
+
+        int locator_bits = 8*8*3;
+
+        int format_bits = 8*4 - 1 + (version >= 7 ? 6*3*2 : 0);
+
+        int timing_bits = 2 * (side - 8*2 -
+                (am_side > 2 ? (am_side - 2) * 5 : 0));
+
+        int function_bits = timing_bits + format_bits + locator_bits
+                + alignment_count * 5*5;
+
+        return side * side - function_bits;
+}
+
+static void print_plan_array(const int * v, int n)
+{
+        int i;
+
+        printf(" {");
+        for (i = 0; i < n; ++i)
+                printf("%s%3d", i ? "," : "", v[i]);
+        printf(" },");
+}
+
+static int print_plan(int version, int col)
+{
+        static const char * const ec_names[4] = {
+                "QR_EC_LEVEL_L", "QR_EC_LEVEL_M",
+                "QR_EC_LEVEL_Q", "QR_EC_LEVEL_H"
+        };
+        static const int size_field[3][4] = {
+                { 10,  9,  8,  8 },
+                { 12, 11, 16, 10 },
+                { 14, 13, 16, 12 }
+        };
+        int capacity = total_capacity(version);
+        int total_words = capacity / 8;
+        int data_words = QR_DATA_WORD_COUNT[version - 1][col];
+        int ec_words = total_words - data_words;
+        int block_count[2], data_length[2], ec_length;
+        int total_blocks;
+        int alignment[7];
+
+        block_count[0] = QR_RS_BLOCK_COUNT[version - 1][col][0];
+        block_count[1] = QR_RS_BLOCK_COUNT[version - 1][col][1];
+        total_blocks = block_count[0] + block_count[1];
+
+        data_length[0] = data_words / total_blocks;
+        data_length[1] = data_length[0] + 1;
+        ec_length = ec_words / total_blocks;
+
+        if (data_length[0] * block_count[0] +
+            data_length[1] * block_count[1] != data_words ||
+            ec_length * total_blocks != ec_words) {
+                fprintf(stderr, "gentables: bad block sizes for %d-%c\n",
+                        version, "LMQH"[col]);
+                return -1;
+        }
+
+        alignment_location(version, alignment);
+
+        printf("\t\t{ %2d, %s, %3d, %5d, %4d, %4d, %4d, %2d,",
+               version, ec_names[col], version * 4 + 17, capacity,
+               total_words, data_words, ec_words, total_blocks);
+        print_plan_array(block_count, 2);
+        print_plan_array(data_length, 2);
+        printf(" %2d, %d,", ec_length, alignment_side(version));
+        print_plan_array(alignment, 7);
+        print_plan_array(size_field[version < 10 ? 0 : version < 27 ? 1 : 2], 4);
+        printf(" },\n");
+
+        return 0;
+}
+
+/* Does mask m invert module (column j, row i)? */
+static int mask_bit(int m, int i, int j)
+{
+        int t;
+
+        switch (m) {
+        case 0: t = (i + j) % 2; break;
+        case 1: t = i % 2; break;
+        case 2: t = j % 3; break;
+        case 3: t = (i + j) % 3; break;
+        case 4: t = (i/2 + j/3) % 2; break;
+        case 5: t = ((i*j) % 2) + ((i*j) % 3); break;
+        case 6: t = (((i*j) % 2) + ((i*j) % 3)) % 2; break;
+        default: t = (((i*j) % 3) + ((i+j) % 2)) % 2; break;
+        }
+
+        return t == 0;
+}
+
+static void print_array(const char * decl, const unsigned int * v, int n)
+{
+        int i;
+
+        printf("%s = {", decl);
+        for (i = 0; i < n; ++i)
+                printf("%s%s%3u", i ? "," : "", i % 12 ? " " : "\n\t", v[i]);
+        printf("\n};\n\n");
+}
+
+int main(void)
+{
+        unsigned int row[256];
+        int i, j, v;
+
+        make_gf_tables();
+
+        printf("/* Generated by gentables; do not edit. */\n\n");
+        printf("#include \"constants.h\"\n");
+        printf("#include \"plan.h\"\n\n");
+
+        print_array("const unsigned char QR_GF_EXP[512]", gf_exp, 512);
+        print_array("const unsigned char QR_GF_LOG[256]", gf_log, 256);
+
+        for (i = 0; i < 256; ++i) {
+                row[i] = 0;
+                for (j = 0; j < 8; ++j)
+                        row[i] |= ((i >> j) & 1) << (7 - j);
+        }
+        print_array("const unsigned char QR_BIT_REVERSE[256]", row, 256);
+
+        /* Shift JIS lead and trail bytes of the characters Kanji
+         * mode can hold (0x8140 ~ 0x9FFC and 0xE040 ~ 0xEBBF)
+         */
+        for (i = 0; i < 256; ++i) {
+                row[i] = 0;
+                if ((i >= 0x81 && i <= 0x9F) || (i >= 0xE0 && i <= 0xEB))
+                        row[i] |= QR_SJIS_LEAD;
+                if (i >= 0x40 && i <= 0xFC && i != 0x7F)
+                        row[i] |= QR_SJIS_TRAIL;
+        }
+        print_array("const unsigned char QR_SJIS_CLASS[256]", row, 256);
+
+        /* Alphanumeric mode codes, with lower case letters taken as
+         * upper case
+         */
+        for (i = 0; i < 256; ++i) {
+                const char * p = strchr(ALPHA_CHARS, toupper(i));
+
+                row[i] = (i && p) ? p - ALPHA_CHARS : QR_ALPHA_NONE;
+        }
+        print_array("const unsigned char QR_ALPHA_CODE[256]", row, 256);
+
+        printf("const unsigned char QR_GF_NIBBLE_LO[256][16] = {\n");
+        for (i = 0; i < 256; ++i) {
+                printf("\t{");
+                for (j = 0; j < 16; ++j)
+                        printf("%s%3u", j ? "," : "", gf_mult(i, j));
+                printf(" },\n");
+        }
+        printf("};\n\n");
+
+        printf("const unsigned char QR_GF_NIBBLE_HI[256][16] = {\n");
+        for (i = 0; i < 256; ++i) {
+                printf("\t{");
+                for (j = 0; j < 16; ++j)
+                        printf("%s%3u", j ? "," : "", gf_mult(i, j << 4));
+                printf(" },\n");
+        }
+        printf("};\n\n");
+
+        printf("const unsigned char QR_RS_GENERATOR[%d][%d] = {\n",
+               RS_MAX_EC_WORDS + 1, RS_MAX_EC_WORDS);
+        for (i = 0; i <= RS_MAX_EC_WORDS; ++i) {
+                make_generator(i, row);
+                printf("\t{");
+                for (j = 0; j < RS_MAX_EC_WORDS; ++j)
+                        printf("%s%3u", j ? "," : "", row[j]);
+                printf(" }, /* %2d */\n", i);
+        }
+        printf("};\n\n");
+
+        /* (15, 5) BCH code, indexed by the 5 data bits (EC, mask) */
+        for (i = 0; i < 32; ++i) {
+                unsigned long bits = (unsigned long) i << (15 - 5);
+                bits |= gf_residue(bits, QR_FORMAT_POLY);
+                row[i] = bits ^ QR_FORMAT_MASK;
+        }
+        printf("const unsigned int QR_FORMAT_BITS[32] = {");
+        for (i = 0; i < 32; ++i)
+                printf("%s%s0x%04X", i ? "," : "", i % 8 ? " " : "\n\t", row[i]);
+        printf("\n};\n\n");
+
+        /* (18, 6) BCH code; only present from version 7 */
+        printf("const unsigned long QR_VERSION_BITS[40] = {");
+        for (v = 1; v <= 40; ++v) {
+                unsigned long bits = 0;
+
+                if (v >= 7) {
+                        bits = (unsigned long) v << (18 - 6);
+                        bits |= gf_residue(bits, QR_VERSION_POLY);
+                }
+
+                printf("%s%s0x%05lX", v > 1 ? "," : "",
+                       (v - 1) % 6 ? " " : "\n\t", bits);
+        }
+        printf("\n};\n\n");
+
+        /* Every mask repeats every 12 rows and columns, so row
+         * i % 12 of the widest symbol covers every row of every
+         * symbol (bytes being packed as in qr_bitmap).
+         */
+        printf("const unsigned char QR_MASK_ROWS[8][12][23] = {\n");
+        for (i = 0; i < 8; ++i) {
+                printf("\t{\n");
+                for (j = 0; j < 12; ++j) {
+                        int k, b;
+
+                        printf("\t\t{");
+                        for (k = 0; k < 23; ++k) {
+                                unsigned int byte = 0;
+                                for (b = 0; b < 8; ++b)
+                                        byte |= mask_bit(i, j, k * 8 + b) << b;
+                                printf("%s0x%02X", k ? "," : "", byte);
+                        }
+                        printf(" },\n");
+                }
+                printf("\t},\n");
+        }
+        printf("};\n\n");
+
+        printf("const struct qr_symbol_plan QR_SYMBOL_PLAN[40][4] = {\n");
+        for (v = 1; v <= 40; ++v) {
+                printf("\t{\n");
+                for (i = 0; i < 4; ++i) {
+                        if (print_plan(v, i) != 0)
+                                return 1;
+                }
+                printf("\t},\n");
+        }
+        printf("};\n");
+
+        return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef QR_KANJI_H
+#define QR_KANJI_H
+
+/* Kanji mode holds the Shift JIS double-byte characters 0x8140 ~
+ * 0x9FFC and 0xE040 ~ 0xEBBF, each as a 13-bit value.
+ */
+
+#define QR_KANJI_BITS 13
+
+/* The value of the character lead, trail, or -1 if there is none */
+int qr_kanji_value(unsigned char lead, unsigned char trail);
+
+/* The two bytes of the character with the given value. Returns 0, or
+ * -1 if no character has that value.
+ */
+int qr_kanji_bytes(unsigned int value, unsigned char * out);
+
+#endif
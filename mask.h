@@ -0,0 +1,34 @@
+#ifndef QR_MASK_H
+#define QR_MASK_H
+
+#include <qr/code.h>
+#include <qr/types.h>
+
+struct qr_template;
+
+/* Penalty scores for each mask of the symbol with the given data
+ * (packed as in qr_bitmap; only the data region is looked at), by
+ * all the rules for QR_MASK_FULL, or the sample QR_MASK_FAST takes.
+ */
+void qr_mask_scores(const struct qr_template * tpl,
+                    const unsigned char *      data,
+                    enum qr_ec_level           ec,
+                    enum qr_mask_policy        policy,
+                    long                       score[8]);
+
+/* Choose the data mask for a code whose modules hold its (unmasked)
+ * data, by the penalty rules of the spec (section 7.8.3) applied to
+ * the finished symbol: all of them for QR_MASK_FULL, and a sample of
+ * rows for QR_MASK_FAST (see qr/code.h). With threads > 1 the masks are
+ * scored in parallel, with the same result. Returns the mask, or -1
+ * if out of memory; the mask's score is stored in *score if score is
+ * not NULL.
+ */
+int qr_mask_select(const struct qr_code * code,
+                   enum qr_ec_level       ec,
+                   enum qr_mask_policy    policy,
+                   int                    threads,
+                   long *                 score);
+
+#endif
+
@@ -0,0 +1,59 @@
+#ifndef QR_PLAN_H
+#define QR_PLAN_H
+
+#include <qr/types.h>
+
+/* Everything derived from a (version, EC level) pair. The table of
+ * these is generated at build time (see gentables.c); nothing here
+ * is ever computed at run time.
+ */
+struct qr_symbol_plan {
+        int              version;
+        enum qr_ec_level ec;
+        int              width;          /* modules per side */
+        int              capacity;       /* modules for data + EC */
+        int              total_words;
+        int              data_words;
+        int              ec_words;
+
+        /* See table 19 of the spec for the layout of EC data. There
+         * are at most two different block lengths ("short" and
+         * "long"), with long blocks one data word longer and coming
+         * after all the short ones. The EC length is the same for both.
+         */
+        int              total_blocks;
+        int              block_count[2];
+        int              data_length[2];
+        int              ec_length;
+
+        /* Alignment patterns are centred on every combination of
+         * alignment[0 ... alignment_side - 1] except the three that
+         * would overlap the locators.
+         */
+        int              alignment_side;
+        int              alignment[7];
+
+        /* Length of the character count field, indexed by
+         * QR_SIZE_FIELD_*
+         */
+        int              size_field[4];
+};
+
+enum {
+        QR_SIZE_FIELD_NUMERIC = 0,
+        QR_SIZE_FIELD_ALPHA   = 1,
+        QR_SIZE_FIELD_8BIT    = 2,
+        QR_SIZE_FIELD_KANJI   = 3
+};
+
+/* Indexed by [version - 1][ec ^ 0x1], ie. L, M, Q, H */
+extern const struct qr_symbol_plan QR_SYMBOL_PLAN[40][4];
+
+#define QR_PLAN(version, ec) (&QR_SYMBOL_PLAN[(version) - 1][(ec) ^ 0x1])
+
+/* The geometry (width, capacity, alignment) does not depend on the
+ * EC level, so any plan for the right version will do.
+ */
+#define QR_GEOMETRY(version) (&QR_SYMBOL_PLAN[(version) - 1][0])
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * A small shared pool of worker threads. Each qr_parallel_for() call
+ * queues a job, which up to threads - 1 workers (started on demand,
+ * and never stopped) join the caller in working through, taking
+ * indices one at a time. A job leaves the queue once all its indices
+ * have been handed out, and the caller waits for the last of them to
+ * finish. Workers pass what they allocated for the job back to the
+ * caller's counters.
+ */
+
+#include <string.h>
+
+#include <qr/allocator.h>
+
+#include "alloc.h"
+#include "pool.h"
+#include "thread.h"
+
+#ifdef QR_NO_THREADS
+
+void qr_parallel_for(int threads, int count, qr_task task, void * arg)
+{
+        int i;
+
+        (void) threads;
+
+        for (i = 0; i < count; ++i)
+                task(arg, i);
+}
+
+#else
+
+struct qr_job {
+        qr_task         task;
+        void *          arg;
+        int             count;
+        int             next;   /* index to hand out next */
+        int             done;   /* indices finished */
+        int             helpers; /* workers that may still join */
+        struct qr_alloc_stats stats; /* of the workers, for the caller */
+        struct qr_job * link;   /* next job in the queue */
+};
+
+static qr_mutex pool_lock = QR_MUTEX_INIT;
+static qr_cond pool_work = QR_COND_INIT;
+static qr_cond pool_done = QR_COND_INIT;
+static struct qr_job * queue;
+static int workers;
+
+/* Run the next index of job; called, and returns, with the lock held */
+static void run_one(struct qr_job * job)
+{
+        int i = job->next++;
+
+        if (job->next == job->count) {
+                struct qr_job ** p = &queue;
+
+                while (*p != job)
+                        p = &(*p)->link;
+                *p = job->link;
+        }
+
+        qr_mutex_unlock(&pool_lock);
+        job->task(job->arg, i);
+        qr_mutex_lock(&pool_lock);
+
+        if (++job->done == job->count)
+                qr_cond_broadcast(&pool_done);
+}
+
+static void * worker(void * unused)
+{
+        struct qr_job * job;
+
+        (void) unused;
+
+        qr_mutex_lock(&pool_lock);
+        for (;;) {
+                for (job = queue; job && job->helpers == 0; job = job->link)
+                        ;
+
+                if (!job) {
+                        qr_cond_wait(&pool_work, &pool_lock);
+                        continue;
+                }
+
+                --job->helpers;
+                while (job->next < job->count) {
+                        run_one(job);
+                        qr_alloc_stats_take(&job->stats);
+                }
+        }
+
+        return 0;
+}
+
+void qr_parallel_for(int threads, int count, qr_task task, void * arg)
+{
+        struct qr_job job;
+
+        if (count <= 0)
+                return;
+
+        if (threads > QR_MAX_THREADS)
+                threads = QR_MAX_THREADS;
+
+        if (threads <= 1 || count == 1) {
+                int i;
+                for (i = 0; i < count; ++i)
+                        task(arg, i);
+                return;
+        }
+
+        job.task = task;
+        job.arg = arg;
+        job.count = count;
+        job.next = 0;
+        job.done = 0;
+        job.helpers = threads - 1;
+        memset(&job.stats, 0, sizeof(job.stats));
+
+        qr_mutex_lock(&pool_lock);
+
+        /* If a thread can't be started, there are just fewer hands */
+        while (workers < threads - 1) {
+                pthread_t thread;
+
+                if (pthread_create(&thread, 0, worker, 0) != 0)
+                        break;
+                pthread_detach(thread);
+                ++workers;
+        }
+
+        job.link = queue;
+        queue = &job;
+        qr_cond_broadcast(&pool_work);
+
+        while (job.next < job.count)
+                run_one(&job);
+
+        while (job.done < job.count)
+                qr_cond_wait(&pool_done, &pool_lock);
+
+        qr_mutex_unlock(&pool_lock);
+
+        qr_alloc_stats_give(&job.stats);
+}
+
+#endif
+
@@ -0,0 +1,16 @@
+#ifndef QR_POOL_H
+#define QR_POOL_H
+
+/* Most threads the pool will use for one call */
+#define QR_MAX_THREADS 16
+
+typedef void (*qr_task)(void * arg, int index);
+
+/* Run task(arg, 0 ... count - 1), on up to threads threads (the
+ * calling thread being one of them), and return once all are done.
+ * Tasks may run in any order, so must not depend on each other.
+ */
+void qr_parallel_for(int threads, int count, qr_task task, void * arg);
+
+#endif
+
@@ -0,0 +1,60 @@
+#ifndef QR_ALLOCATOR_H
+#define QR_ALLOCATOR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Heap allocator hooks. Everything the library allocates for objects
+ * outside a context, and the blocks a context grows by, comes from
+ * these. The exceptions are the strings from qr_parse_data(), which
+ * are for the caller to free(), and the per-version tables the
+ * library builds once and keeps for good, which always come from
+ * malloc().
+ *
+ * The hooks must be set before any other use of the library, and
+ * not changed while anything allocated through them is still alive.
+ * NULL restores malloc(), realloc() and free().
+ */
+struct qr_allocator {
+        void * (*alloc)(void * user, size_t size);
+        void * (*realloc)(void * user, void * ptr, size_t size);
+        void   (*free)(void * user, void * ptr);
+        void *   user;
+};
+
+void qr_set_allocator(const struct qr_allocator *);
+
+/**
+ * Counters of heap use through the hooks, kept for each thread. To
+ * measure a single call, reset the counters before it and read them
+ * after, in the same thread; other threads' calls do not disturb
+ * them. Work the library hands to its own worker threads (threads in
+ * qr_code_options, or a batch) is counted to the calling thread once
+ * the call returns.
+ *
+ * current is what the thread has allocated less what it has freed,
+ * so it goes below zero in a thread that frees blocks others made.
+ */
+struct qr_alloc_stats {
+        unsigned long count;   /* allocations, reallocations included */
+        unsigned long bytes;   /* total size of them */
+        long          current; /* bytes allocated now */
+        long          peak;    /* most allocated at once */
+};
+
+void qr_get_alloc_stats(struct qr_alloc_stats *);
+
+/* Zero the calling thread's count and bytes, and bring its peak down
+ * to current
+ */
+void qr_reset_alloc_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
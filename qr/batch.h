@@ -0,0 +1,44 @@
+#ifndef QR_BATCH_H
+#define QR_BATCH_H
+
+#include <stddef.h>
+#include "types.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct qr_batch_item {
+        /* Input, as for qr_data_create() */
+        int                 version; /* 1 ~ 40; 0=auto */
+        enum qr_ec_level    ec;
+        enum qr_data_type   type;
+        const char *        input;
+        size_t              length;
+
+        /* Result */
+        struct qr_code *    code;    /* on the heap, or NULL on failure */
+        struct qr_code_info info;
+};
+
+/**
+ * Encode a batch of inputs, each as qr_data_create() followed by
+ * qr_code_create_ex(), storing the results in the items.
+ *
+ * options may be NULL for the defaults. Its threads field here gives
+ * the number of threads to spread the batch over (each symbol is
+ * then encoded by one thread), and its ctx is not used: the codes are
+ * created on the heap, for qr_code_destroy().
+ *
+ * Returns the number of items that could not be encoded.
+ */
+size_t qr_encode_batch(struct qr_batch_item *         items,
+                       size_t                         count,
+                       const struct qr_code_options * options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
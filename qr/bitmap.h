@@ -1,6 +1,9 @@
 #ifndef QR_BITMAP_H
 #define QR_BITMAP_H
 
+#include <stddef.h>
+#include "types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,6 +13,7 @@ struct qr_bitmap {
         unsigned char * mask;
         size_t stride;
         size_t width, height;
+        struct qr_context * ctx; /* owner, or NULL for the heap */
 };
 
 struct qr_bitmap * qr_bitmap_create(size_t width, size_t height, int masked);
@@ -42,6 +42,10 @@ int qr_bitstream_pack(struct qr_bitstream *,
                       size_t               count,
                       int                  bitsize);
 
+int qr_bitstream_write_bytes(struct qr_bitstream *,
+                             const unsigned char * bytes,
+                             size_t                count);
+
 int qr_bitstream_cat(struct qr_bitstream *,
                      const struct qr_bitstream * src);
 
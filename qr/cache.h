@@ -0,0 +1,59 @@
+#ifndef QR_CACHE_H
+#define QR_CACHE_H
+
+#include <stddef.h>
+#include "types.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A cache of finished symbols, keyed by their input, version, EC
+ * level, data type and mask policy, for callers that encode the same
+ * payloads over and over. Least recently used symbols are dropped to
+ * keep within a memory budget, which is shared by the whole cache.
+ * The cache is split into shards with a lock each, so it can be
+ * shared between threads; while they insert at once it may go over
+ * budget by the symbols in flight.
+ */
+
+struct qr_cache;
+
+struct qr_cache_stats {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+        size_t        entries;
+        size_t        bytes;     /* held, counting overheads */
+};
+
+/* budget is in bytes, and is raised to what the largest symbol (with
+ * its input) takes if it is less than that; returns NULL if out of
+ * memory
+ */
+struct qr_cache * qr_cache_create(size_t budget);
+void qr_cache_destroy(struct qr_cache *);
+
+/* As qr_data_create() + qr_code_create_ex(), but from the cache if
+ * the same symbol has been made before. The code returned is the
+ * caller's, to qr_code_destroy(); options and info may be NULL, and
+ * any ctx in options is used for the code returned.
+ */
+struct qr_code * qr_cache_encode(struct qr_cache *              cache,
+                                 int                            version,
+                                 enum qr_ec_level               ec,
+                                 enum qr_data_type              type,
+                                 const char *                   input,
+                                 size_t                         length,
+                                 const struct qr_code_options * options,
+                                 struct qr_code_info *          info);
+
+void qr_cache_stats(struct qr_cache *, struct qr_cache_stats *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
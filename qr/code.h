@@ -11,10 +11,45 @@ extern "C" {
 struct qr_code {
         int                version;
         struct qr_bitmap * modules;
+        struct qr_context * ctx; /* owner, or NULL for the heap */
 };
 
 struct qr_code * qr_code_create(const struct qr_data * data);
 
+/* QR_MASK_FAST scores two rows out of every eight, by the rules along
+ * and between them and their dark balance, and takes the rows as
+ * standing in for the columns, which it never looks at. It costs
+ * about a quarter of QR_MASK_FULL's search, and picks a valid mask,
+ * but often not the one with the lowest spec penalty.
+ */
+enum qr_mask_policy {
+        QR_MASK_FULL  = 0, /* spec penalty search over all 8 masks */
+        QR_MASK_FAST  = 1, /* sampled rows only, see above */
+        QR_MASK_FIXED = 2  /* use the given mask, unscored */
+};
+
+struct qr_code_options {
+        struct qr_context * ctx;    /* to create the code in, or NULL */
+        enum qr_mask_policy policy;
+        int                 mask;   /* 0 ~ 7, for QR_MASK_FIXED */
+        int                 threads; /* to share the work with,
+                                      * or 0 for just the caller */
+};
+
+struct qr_code_info {
+        int                 mask;   /* mask used */
+        long                score;  /* its penalty score (estimated
+                                     * for QR_MASK_FAST), or -1 if
+                                     * not scored */
+};
+
+/* As qr_code_create(); options may be NULL for the defaults (as
+ * qr_code_create()), and info NULL if not wanted.
+ */
+struct qr_code * qr_code_create_ex(const struct qr_data *         data,
+                                   const struct qr_code_options * options,
+                                   struct qr_code_info *          info);
+
 void qr_code_destroy(struct qr_code *);
 
 #ifdef __cplusplus
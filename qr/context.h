@@ -0,0 +1,49 @@
+#ifndef QR_CONTEXT_H
+#define QR_CONTEXT_H
+
+#include <stddef.h>
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An encode context is an arena that data and codes can be created
+ * in, so that generating a run of symbols need not touch the heap.
+ *
+ * Everything created in a context belongs to it: the usual _destroy
+ * functions may still be called on such objects but release nothing,
+ * and all of them become invalid at once when the context is reset
+ * or destroyed.
+ *
+ * If a buffer is given, the context (including its own bookkeeping)
+ * lives entirely inside it until it is full; the buffer must be
+ * aligned as for malloc(). Without one, or once it runs out, the
+ * context grows itself from the heap. Space it has grown is kept
+ * across resets, so once a workload has run through once it does no
+ * further allocation.
+ */
+
+struct qr_context;
+
+struct qr_context * qr_context_create(void * buffer, size_t size);
+void qr_context_reset(struct qr_context *);
+void qr_context_destroy(struct qr_context *);
+
+struct qr_data * qr_data_create_ctx(struct qr_context * ctx,
+                                    int                 version,
+                                    enum qr_ec_level    ec,
+                                    enum qr_data_type   type,
+                                    const char *        input,
+                                    size_t              length);
+
+struct qr_code * qr_code_create_ctx(struct qr_context *     ctx,
+                                    const struct qr_data *  data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -13,14 +13,26 @@ struct qr_data {
         enum qr_ec_level      ec;
         struct qr_bitstream * bits;
         size_t                offset;
+        struct qr_context *   ctx; /* owner, or NULL for the heap */
 };
 
+/* QR_DATA_KANJI input is Shift JIS, and its length is in bytes. With
+ * QR_DATA_MIXED, the input is split into numeric, alphanumeric, 8-bit
+ * and Kanji segments so as to take the fewest bits. QR_DATA_AUTO takes
+ * the type from qr_data_classify().
+ */
 struct qr_data * qr_data_create(int               format, /* 1 ~ 40; 0=auto */
                                 enum qr_ec_level  ec,
                                 enum qr_data_type type,
                                 const char *      input,
                                 size_t            length);
 
+/* The most compact single type that can hold all of the input:
+ * numeric, alphanumeric, Kanji (if it is all Shift JIS characters
+ * Kanji mode can hold) or else 8-bit
+ */
+enum qr_data_type qr_data_classify(const char * input, size_t length);
+
 void qr_data_destroy(struct qr_data *);
 
 enum qr_data_type qr_data_type(const struct qr_data *);
@@ -1,19 +1,41 @@
 #ifndef QR_CODE_LAYOUT_H
 #define QR_CODE_LAYOUT_H
 
+#include <stddef.h>
+#include "types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct qr_iterator;
 
-void qr_layout_init_mask(struct qr_code *);
+/* Mark the data modules in the code's bitmap mask (adding one if it
+ * has none). Returns 0, or -1 if out of memory.
+ */
+int qr_layout_init_mask(struct qr_code *);
 
 struct qr_iterator * qr_layout_begin(struct qr_code * code);
 unsigned int qr_layout_read(struct qr_iterator *);
 void qr_layout_write(struct qr_iterator *, unsigned int);
 void qr_layout_end(struct qr_iterator *);
 
+/* Place / gather count whole codewords, starting from the first.
+ * Returns 0, or -1 if out of memory.
+ */
+int qr_layout_write_words(struct qr_code *,
+                          const unsigned char * words,
+                          size_t                count);
+int qr_layout_read_words(const struct qr_code *,
+                         unsigned char * words,
+                         size_t          count);
+
+/* Invert the modules of codeword index where bits has a 1. Since a
+ * data mask is an XOR, this works on masked codes too. Returns 0, or
+ * -1 if out of memory.
+ */
+int qr_layout_flip_word(struct qr_code *, size_t index, unsigned int bits);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,9 @@ int qr_code_parse(const void *      buffer,
                   size_t            line_count,
                   struct qr_data ** data);
 
+/* Decode format / version info, correcting up to 3 bit errors.
+ * Returns the number of bits corrected, or -1 if there are too many.
+ */
 int qr_decode_format(unsigned long bits, enum qr_ec_level * ec, int * mask);
 int qr_decode_version(unsigned long bits, int * version);
 
@@ -0,0 +1,62 @@
+#ifndef QR_SERIAL_H
+#define QR_SERIAL_H
+
+#include <stddef.h>
+#include "types.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Serialised codes: a run of symbols from one template input of
+ * which only some characters change (a serial number, say).
+ *
+ * The template is encoded once. Each update then re-encodes just the
+ * changed characters, and since the EC words are linear in the data
+ * words, patches the EC words and placed modules for the data words
+ * that changed; the cost goes with the size of the change, not of
+ * the symbol. The mask chosen for the template is kept unless
+ * qr_serial_select_mask() is called.
+ */
+
+struct qr_serial;
+
+/* As qr_data_create() + qr_code_create_ex(); options may be NULL,
+ * and their ctx is not used (the serial lives on the heap). The type
+ * must be numeric, alphanumeric, 8-bit or Kanji (or QR_DATA_AUTO,
+ * which picks one of them); anything else returns NULL.
+ */
+struct qr_serial * qr_serial_create(int                            version,
+                                    enum qr_ec_level               ec,
+                                    enum qr_data_type              type,
+                                    const char *                   input,
+                                    size_t                         length,
+                                    const struct qr_code_options * options);
+
+/* Replace characters offset ... offset + length - 1 of the input.
+ * Returns 0, or -1 if they are out of range or not valid for the
+ * type (in which case the code is unchanged).
+ */
+int qr_serial_update(struct qr_serial * serial,
+                     size_t             offset,
+                     const char *       chars,
+                     size_t             length);
+
+/* Choose the mask afresh for the current data, by the policy the
+ * serial was created with (a fixed mask stays). Returns the mask,
+ * or -1 if out of memory.
+ */
+int qr_serial_select_mask(struct qr_serial * serial);
+
+/* The current code; it belongs to the serial, and changes with it */
+const struct qr_code * qr_serial_code(const struct qr_serial * serial);
+
+void qr_serial_destroy(struct qr_serial * serial);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,7 @@ extern "C" {
 
 struct qr_data;
 struct qr_code;
+struct qr_context;
 
 enum qr_data_type {
         QR_DATA_INVALID = -1,
@@ -16,7 +17,8 @@ enum qr_data_type {
         QR_DATA_8BIT    =  4,
         QR_DATA_KANJI   =  8, /* JIS X 0208 */
         QR_DATA_MIXED   =  3,
-        QR_DATA_FNC1    =  9
+        QR_DATA_FNC1    =  9,
+        QR_DATA_AUTO    = -2  /* see qr_data_classify() */
 };
 
 enum qr_ec_level {
@@ -205,6 +205,8 @@ void show_help() {
                 "\t-f <file>  File containing data to encode (- for stdin)\n"
                 "\t-v <n>     Specify QR version (size) 1 <= n <= 40\n"
                 "\t-e <type>  Specify EC type: L, M, Q, H\n"
+                "\t-t <type>  Specify data type: auto, numeric, alpha,\n"
+                "\t           8bit (default), kanji, mixed\n"
                 "\t-a         Output as ANSI graphics (default)\n"
                 "\t-p         Output as PBM\n"
                 "\t-g         Output as PNG\n"
@@ -212,6 +214,28 @@ void show_help() {
                 "qrgen");
 }
 
+enum qr_data_type parse_type(const char * name)
+{
+        static const struct {
+                const char *      name;
+                enum qr_data_type type;
+        } types[] = {
+                { "auto",       QR_DATA_AUTO },
+                { "numeric",    QR_DATA_NUMERIC },
+                { "alpha",      QR_DATA_ALPHA },
+                { "8bit",       QR_DATA_8BIT },
+                { "kanji",      QR_DATA_KANJI },
+                { "mixed",      QR_DATA_MIXED }
+        };
+        size_t i;
+
+        for (i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+                if (strcmp(name, types[i].name) == 0)
+                        return types[i].type;
+
+        return QR_DATA_INVALID;
+}
+
 void set_default_config(struct config * conf)
 {
         conf->version = 0;
@@ -262,7 +286,14 @@ void parse_options(int argc, char ** argv, struct config * conf)
                         }
                         break;
                 case 't': /* type */
-                        fprintf(stderr, "XXX: ignored \"type\"\n");
+                        conf->dtype = parse_type(optarg);
+                        if (conf->dtype == QR_DATA_INVALID) {
+                                fprintf(stderr,
+                                        "Invalid data type (%s). Choose from"
+                                        " auto, numeric, alpha, 8bit, kanji"
+                                        " or mixed.\n", optarg);
+                                exit(1);
+                        }
                         break;
                 case 'a': /* ansi */
                         conf->format = FORMAT_ANSI; break;
@@ -0,0 +1,47 @@
+#ifndef QR_SEGMENT_H
+#define QR_SEGMENT_H
+
+#include <stddef.h>
+
+/* Vectorised segment encoders (data-simd.c). Each getter returns the
+ * best kernel the running CPU supports, or 0 if there is none.
+ *
+ * The group kernels convert whole blocks of input from the start,
+ * never reading past in[length - 1], and stop at the first block
+ * holding anything the mode cannot encode (which the caller then
+ * finds for itself). They return the number of input bytes taken:
+ * three digits to each 10-bit value for numeric mode, two characters
+ * to each 11-bit value for alphanumeric mode.
+ */
+typedef size_t (*qr_group_kernel)(const unsigned char * in,
+                                  size_t                length,
+                                  unsigned int *        out);
+
+qr_group_kernel qr_numeric_simd_kernel(void);
+qr_group_kernel qr_alpha_simd_kernel(void);
+
+/* Reverse the bits of each byte, for as many bytes as it can; the
+ * caller does the rest with QR_BIT_REVERSE. Returns the number done.
+ */
+typedef size_t (*qr_reverse_kernel)(const unsigned char * in,
+                                    size_t                length,
+                                    unsigned char *       out);
+
+qr_reverse_kernel qr_reverse_simd_kernel(void);
+
+/* Input classes for qr_data_classify(): the modes that could hold all
+ * of the input. The kernel clears the classes any whole block it
+ * reads rules out, stopping early once none are left, and returns
+ * the number of bytes it read (always even, for Kanji pairs).
+ */
+#define QR_CLASS_NUMERIC        1
+#define QR_CLASS_ALPHA          2
+#define QR_CLASS_KANJI          4
+
+typedef size_t (*qr_classify_kernel)(const unsigned char * in,
+                                     size_t                length,
+                                     unsigned int *        classes);
+
+qr_classify_kernel qr_classify_simd_kernel(void);
+
+#endif
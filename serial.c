@@ -0,0 +1,394 @@
+/**
+ * Serialised codes. Alongside the finished code, the serial keeps
+ * the codewords block by block (data words back to back, then the EC
+ * words of each block, as make_data() builds them), and a copy of the
+ * symbol with just the unmasked data, for choosing the mask again.
+ *
+ * The EC words of a block are a linear function of its data words,
+ * so changing data word j by d changes them by d times the EC words
+ * of the block that is all zero but for a 1 at j. Those unit rows are
+ * worked out once per block length when the serial is created.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <qr/bitmap.h>
+#include <qr/bitstream.h>
+#include <qr/code.h>
+#include <qr/common.h>
+#include <qr/context.h>
+#include <qr/data.h>
+#include <qr/layout.h>
+#include <qr/serial.h>
+#include "alloc.h"
+#include "constants.h"
+#include "galois.h"
+#include "mask.h"
+#include "plan.h"
+#include "template.h"
+
+struct qr_serial {
+        const struct qr_symbol_plan * plan;
+        enum qr_data_type             type;
+        struct qr_code_options        options;
+        int                           mask;
+
+        char *                        input;
+        size_t                        length;
+
+        unsigned char *               words; /* block order */
+        unsigned char *               rows[2]; /* unit rows, per type */
+
+        struct qr_code *              code;
+        struct qr_code *              raw;   /* unmasked data only */
+        struct qr_context *           scratch;
+};
+
+/* Input bytes per group in the encoding of the data */
+static int group_size(enum qr_data_type type)
+{
+        switch (type) {
+        case QR_DATA_NUMERIC:   return 3;
+        case QR_DATA_ALPHA:     return 2;
+        case QR_DATA_8BIT:      return 1;
+        case QR_DATA_KANJI:     return 2;
+        default:                return 0;
+        }
+}
+
+/* Bits for the first n bytes of input */
+static size_t input_bits(enum qr_data_type type, size_t n)
+{
+        return qr_data_dpart_length(type, type == QR_DATA_KANJI ? n / 2 : n);
+}
+
+/* Position of data word j of a block in the interleaved codewords */
+static size_t data_index(const struct qr_symbol_plan * plan,
+                         int block, int j)
+{
+        if (j < plan->data_length[0])
+                return (size_t) j * plan->total_blocks + block;
+
+        return (size_t) plan->data_length[0] * plan->total_blocks
+                + block - plan->block_count[0];
+}
+
+static size_t ec_index(const struct qr_symbol_plan * plan, int block, int k)
+{
+        return plan->data_words + (size_t) k * plan->total_blocks + block;
+}
+
+static int flip(struct qr_serial * s, size_t index, unsigned int bits)
+{
+        if (qr_layout_flip_word(s->code, index, bits) != 0 ||
+            qr_layout_flip_word(s->raw, index, bits) != 0)
+                return -1;
+
+        return 0;
+}
+
+/* Change data word w (in stream order) by delta, and its block's
+ * EC words to match
+ */
+static int change_word(struct qr_serial * s, size_t w, unsigned int delta)
+{
+        const struct qr_symbol_plan * plan = s->plan;
+        const int short_words = plan->block_count[0] * plan->data_length[0];
+        const int ec_length = plan->ec_length;
+        unsigned char * ecw = s->words + plan->data_words;
+        const unsigned char * row;
+        int block, j, type, k;
+
+        if ((int) w < short_words) {
+                type = 0;
+                block = w / plan->data_length[0];
+                j = w % plan->data_length[0];
+        } else {
+                type = 1;
+                block = plan->block_count[0]
+                      + (w - short_words) / plan->data_length[1];
+                j = (w - short_words) % plan->data_length[1];
+        }
+
+        row = s->rows[type] + (size_t) j * ec_length;
+
+        s->words[w] ^= delta;
+        if (flip(s, data_index(plan, block, j), delta) != 0)
+                return -1;
+
+        for (k = 0; k < ec_length; ++k) {
+                unsigned int e = gf_mult(delta, row[k]);
+
+                ecw[block * ec_length + k] ^= e;
+                if (e && flip(s, ec_index(plan, block, k), e) != 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+int qr_serial_update(struct qr_serial * s,
+                     size_t             offset,
+                     const char *       chars,
+                     size_t             length)
+{
+        const int g = group_size(s->type);
+        struct qr_data * data;
+        size_t first, last, pos, end, w;
+        char * group;
+        int header;
+
+        if (length == 0)
+                return 0;
+        if (offset > s->length || length > s->length - offset || g == 0)
+                return -1;
+
+        /* Encode the whole groups the change touches, on their own,
+         * and check them before anything is changed
+         */
+        first = offset / g * g;
+        last = (offset + length + g - 1) / g * g;
+        if (last > s->length)
+                last = s->length;
+
+        qr_context_reset(s->scratch);
+        group = qr_alloc(s->scratch, last - first);
+        if (!group)
+                return -1;
+        memcpy(group, s->input + first, last - first);
+        memcpy(group + (offset - first), chars, length);
+
+        data = qr_data_create_ctx(s->scratch, s->plan->version,
+                                  s->plan->ec, s->type,
+                                  group, last - first);
+        if (!data)
+                return -1;
+        memcpy(s->input + offset, chars, length);
+
+        header = 4 + qr_data_size_field_length(s->plan->version, s->type);
+        qr_bitstream_seek(data->bits, header);
+
+        /* ... and merge their bits in, a word at a time */
+        pos = header + input_bits(s->type, first);
+        end = pos + input_bits(s->type, last - first);
+
+        for (w = pos / QR_WORD_BITS; pos < end; ++w) {
+                size_t stop = (w + 1) * QR_WORD_BITS;
+                int n, shift;
+                unsigned int value, delta;
+
+                if (stop > end)
+                        stop = end;
+                n = stop - pos;
+                shift = (w + 1) * QR_WORD_BITS - stop;
+
+                value = qr_bitstream_read(data->bits, n) << shift;
+                delta = (s->words[w] ^ value) & (((1u << n) - 1) << shift);
+
+                if (delta && change_word(s, w, delta) != 0)
+                        return -1;
+
+                pos = stop;
+        }
+
+        return 0;
+}
+
+int qr_serial_select_mask(struct qr_serial * s)
+{
+        const struct qr_template * tpl;
+        const unsigned char * fv_old, * fv_new;
+        struct qr_bitmap * bmp = s->code->modules;
+        int mask, f;
+
+        if (s->options.policy == QR_MASK_FIXED)
+                return s->mask;
+
+        mask = qr_mask_select(s->raw, s->plan->ec, s->options.policy,
+                              s->options.threads, 0);
+        if (mask < 0 || mask == s->mask)
+                return mask;
+
+        /* Swap the data masks over, only over the data region */
+        tpl = qr_template_get(s->plan->version);
+        bmp->mask = s->raw->modules->mask;
+        qr_mask_apply(bmp, s->mask);
+        qr_mask_apply(bmp, mask);
+        bmp->mask = 0;
+
+        fv_old = tpl->format_value[(s->plan->ec & 0x3) << 3 | s->mask];
+        fv_new = tpl->format_value[(s->plan->ec & 0x3) << 3 | mask];
+        for (f = 0; f < tpl->format_count; ++f)
+                bmp->bits[tpl->format_offset[f]] ^= fv_old[f] ^ fv_new[f];
+
+        s->mask = mask;
+
+        return mask;
+}
+
+const struct qr_code * qr_serial_code(const struct qr_serial * s)
+{
+        return s->code;
+}
+
+/* Recover the codewords of the finished code, block by block */
+static int read_words(struct qr_serial * s)
+{
+        const struct qr_symbol_plan * plan = s->plan;
+        struct qr_bitmap * bmp;
+        unsigned char * all;
+        size_t i, n;
+        int block, j, k;
+
+        s->raw = qr_alloc(0, sizeof(*s->raw));
+        if (!s->raw)
+                return -1;
+        s->raw->version = plan->version;
+        s->raw->ctx = 0;
+        s->raw->modules = qr_bitmap_clone(s->code->modules);
+        if (!s->raw->modules)
+                return -1;
+
+        if (qr_layout_init_mask(s->raw) != 0)
+                return -1;
+        bmp = s->raw->modules;
+
+        qr_mask_apply(bmp, s->mask);
+        n = bmp->stride * bmp->height;
+        for (i = 0; i < n; ++i)
+                bmp->bits[i] &= bmp->mask[i];
+
+        all = qr_alloc(0, plan->total_words);
+        if (!all)
+                return -1;
+
+        if (qr_layout_read_words(s->raw, all, plan->total_words) != 0) {
+                qr_free(0, all);
+                return -1;
+        }
+
+        i = 0;
+        for (block = 0; block < plan->total_blocks; ++block) {
+                int len = plan->data_length[block >= plan->block_count[0]];
+
+                for (j = 0; j < len; ++j)
+                        s->words[i++] = all[data_index(plan, block, j)];
+        }
+        for (block = 0; block < plan->total_blocks; ++block)
+                for (k = 0; k < plan->ec_length; ++k)
+                        s->words[i++] = all[ec_index(plan, block, k)];
+
+        qr_free(0, all);
+
+        return 0;
+}
+
+static int make_rows(struct qr_serial * s)
+{
+        const struct qr_symbol_plan * plan = s->plan;
+        unsigned char unit[RS_MAX_BLOCK_WORDS];
+        int type, j;
+
+        for (type = 0; type < 2; ++type) {
+                const int len = plan->data_length[type];
+
+                if (plan->block_count[type] == 0)
+                        continue;
+
+                s->rows[type] = qr_alloc(0, (size_t) len * plan->ec_length);
+                if (!s->rows[type])
+                        return -1;
+
+                memset(unit, 0, len);
+                for (j = 0; j < len; ++j) {
+                        unit[j] = 1;
+                        rs_encode_block(unit, len,
+                                        s->rows[type] + j * plan->ec_length,
+                                        plan->ec_length);
+                        unit[j] = 0;
+                }
+        }
+
+        return 0;
+}
+
+struct qr_serial * qr_serial_create(int                            version,
+                                    enum qr_ec_level               ec,
+                                    enum qr_data_type              type,
+                                    const char *                   input,
+                                    size_t                         length,
+                                    const struct qr_code_options * options)
+{
+        struct qr_serial * s;
+        struct qr_data * data;
+        struct qr_code_info info;
+
+        /* Only types that qr_serial_update() can re-encode */
+        if (type == QR_DATA_AUTO)
+                type = qr_data_classify(input, length);
+        if (group_size(type) == 0)
+                return 0;
+
+        s = qr_alloc(0, sizeof(*s));
+        if (!s)
+                return 0;
+
+        memset(s, 0, sizeof(*s));
+        s->type = type;
+        if (options) {
+                s->options = *options;
+        } else {
+                s->options.policy = QR_MASK_FULL;
+                s->options.mask = 0;
+                s->options.threads = 0;
+        }
+        s->options.ctx = 0;
+
+        s->length = length;
+        s->input = qr_alloc(0, length + 1);
+        s->scratch = qr_context_create(0, 0);
+        if (!s->input || !s->scratch)
+                goto fail;
+        memcpy(s->input, input, length);
+
+        data = qr_data_create(version, ec, type, input, length);
+        if (!data)
+                goto fail;
+
+        s->plan = QR_PLAN(data->version, ec);
+        s->code = qr_code_create_ex(data, &s->options, &info);
+        qr_data_destroy(data);
+        if (!s->code)
+                goto fail;
+        s->mask = info.mask;
+
+        s->words = qr_alloc(0, s->plan->total_words);
+        if (!s->words)
+                goto fail;
+
+        if (read_words(s) != 0 || make_rows(s) != 0)
+                goto fail;
+
+        return s;
+
+fail:
+        qr_serial_destroy(s);
+        return 0;
+}
+
+void qr_serial_destroy(struct qr_serial * s)
+{
+        if (!s)
+                return;
+
+        qr_code_destroy(s->code);
+        qr_code_destroy(s->raw);
+        qr_context_destroy(s->scratch);
+        qr_free(0, s->rows[0]);
+        qr_free(0, s->rows[1]);
+        qr_free(0, s->words);
+        qr_free(0, s->input);
+        qr_free(0, s);
+}
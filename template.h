@@ -0,0 +1,41 @@
+#ifndef QR_TEMPLATE_H
+#define QR_TEMPLATE_H
+
+#include <stddef.h>
+
+#include <qr/types.h>
+
+/* Upper bound on the bytes covered by one copy of the format info
+ * plus the other (row 8 and column 8 near the locators)
+ */
+#define QR_FORMAT_BYTES 20
+
+/* Everything about a symbol that only depends on its version, laid
+ * out in the same way as the bits of a qr_bitmap of that version.
+ * A finished symbol is bits | (data & mask) | the format overlay.
+ */
+struct qr_template {
+        int             version;
+        size_t          width;
+        size_t          stride;
+        unsigned char * bits;   /* function patterns and version info */
+        unsigned char * mask;   /* the data region */
+
+        /* Format info for (ec << 3) | mask, as bytes to OR in at
+         * format_offset[0 ... format_count - 1]
+         */
+        int             format_count;
+        size_t          format_offset[QR_FORMAT_BYTES];
+        unsigned char   format_value[32][QR_FORMAT_BYTES];
+};
+
+/* Built on first use and shared; NULL if out of memory */
+const struct qr_template * qr_template_get(int version);
+
+void qr_template_draw_format(const struct qr_template * tpl,
+                             unsigned char *            bits,
+                             enum qr_ec_level           ec,
+                             int                        mask);
+
+#endif
+
@@ -0,0 +1,49 @@
+#ifndef QR_THREAD_H
+#define QR_THREAD_H
+
+/* Just enough threading for the library's shared state. Building
+ * with QR_NO_THREADS drops the pthreads dependency, in which case
+ * the library must only be used from one thread at a time.
+ */
+
+#ifdef QR_NO_THREADS
+
+typedef int qr_mutex;
+#define QR_MUTEX_INIT           0
+#define qr_mutex_init(m)        ((void) (m))
+#define qr_mutex_destroy(m)     ((void) (m))
+#define qr_mutex_lock(m)        ((void) (m))
+#define qr_mutex_unlock(m)      ((void) (m))
+
+typedef int qr_cond;
+#define QR_COND_INIT            0
+#define qr_cond_wait(c, m)      ((void) (c), (void) (m))
+#define qr_cond_broadcast(c)    ((void) (c))
+
+#define QR_THREAD_LOCAL
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_mutex_t qr_mutex;
+#define QR_MUTEX_INIT           PTHREAD_MUTEX_INITIALIZER
+#define qr_mutex_init(m)        pthread_mutex_init(m, 0)
+#define qr_mutex_destroy(m)     pthread_mutex_destroy(m)
+#define qr_mutex_lock(m)        pthread_mutex_lock(m)
+#define qr_mutex_unlock(m)      pthread_mutex_unlock(m)
+
+typedef pthread_cond_t qr_cond;
+#define QR_COND_INIT            PTHREAD_COND_INITIALIZER
+#define qr_cond_wait(c, m)      pthread_cond_wait(c, m)
+#define qr_cond_broadcast(c)    pthread_cond_broadcast(c)
+
+/* Storage class for per-thread variables, where there is one */
+#ifdef __GNUC__
+#define QR_THREAD_LOCAL         __thread
+#endif
+
+#endif
+
+#endif
+